@@ -0,0 +1,1262 @@
+#include "../includes/TerreateCore.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+using namespace TerreateCore;
+using namespace TerreateCore::Defines;
+
+// Every allocation in the process is counted so benches can report
+// allocations per task.
+static Atomic<Size> sNumAllocations = 0u;
+static Atomic<Size> sNumAllocatedBytes = 0u;
+
+void *CountedAllocate(std::size_t size, std::size_t alignment) {
+  sNumAllocations.fetch_add(1, std::memory_order_relaxed);
+  sNumAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  size = size ? size : 1;
+  void *ptr = nullptr;
+  if (alignment <= alignof(std::max_align_t)) {
+    ptr = std::malloc(size);
+  } else {
+    // aligned_alloc wants a multiple of the alignment.
+    ptr = std::aligned_alloc(alignment,
+                             (size + alignment - 1) / alignment * alignment);
+  }
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+// Plain, array and over-aligned forms all draw from CountedAllocate, and
+// every delete returns the memory to free().
+void *operator new(std::size_t size) {
+  return CountedAllocate(size, alignof(std::max_align_t));
+}
+void *operator new[](std::size_t size) {
+  return CountedAllocate(size, alignof(std::max_align_t));
+}
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return CountedAllocate(size, static_cast<std::size_t>(alignment));
+}
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return CountedAllocate(size, static_cast<std::size_t>(alignment));
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+Str ModeName(Utils::SchedulingMode const &mode) {
+  return mode == Utils::SchedulingMode::WorkStealing ? "work-stealing"
+                                                     : "single-queue";
+}
+
+Double Measure(Function<void()> const &body) {
+  SteadyTimePoint start = Now();
+  body();
+  return DurationCast<chrono::duration<Double>>(Now() - start).count();
+}
+
+// Figures worth tracking between releases. Suites record them alongside
+// their console output and --json writes them out.
+struct BenchResult {
+  Str suite;
+  Str name;
+  Double value;
+  Str unit;
+};
+
+static Vec<BenchResult> sResults;
+static Str sCurrentSuite;
+
+void RecordResult(Str const &name, Double const &value, Str const &unit) {
+  sResults.push_back({sCurrentSuite, name, value, unit});
+}
+
+Bool WriteResults(Str const &path) {
+  std::ofstream file(path);
+  if (!file) {
+    return false;
+  }
+  file << "{\n  \"hardware_concurrency\": "
+       << std::thread::hardware_concurrency() << ",\n  \"results\": [";
+  for (Size i = 0; i < sResults.size(); ++i) {
+    BenchResult const &result = sResults[i];
+    file << (i == 0 ? "\n" : ",\n") << "    {\"suite\": \"" << result.suite
+         << "\", \"name\": \"" << result.name << "\", \"value\": "
+         << std::setprecision(17) << result.value << ", \"unit\": \""
+         << result.unit << "\"}";
+  }
+  file << "\n  ]\n}\n";
+  return static_cast<Bool>(file);
+}
+
+void Report(Str const &name, Utils::SchedulingMode const &mode,
+            Uint const &numThreads, Size const &numTasks,
+            Double const &seconds) {
+  std::cout << std::left << std::setw(10) << name << std::setw(15)
+            << ModeName(mode) << std::right << std::setw(4) << numThreads
+            << std::setw(14) << std::fixed << std::setprecision(0)
+            << numTasks / seconds << " tasks/s" << std::endl;
+  RecordResult(name + "/" + ModeName(mode) + "/" + ToStr(numThreads),
+               numTasks / seconds, "tasks/s");
+}
+
+// Small jobs submitted from outside the executor.
+void FlatBench(Utils::SchedulingMode const &mode, Uint const &numThreads) {
+  Size const numTasks = 20000;
+  Atomic<Size> counter = 0;
+  Utils::Executor executor(numThreads, mode);
+  Double seconds = Measure([&]() {
+    for (Size i = 0; i < numTasks; ++i) {
+      executor.Schedule([&counter]() { counter.fetch_add(1); });
+    }
+    while (counter.load() != numTasks) {
+      std::this_thread::yield();
+    }
+  });
+  Report("flat", mode, numThreads, numTasks, seconds);
+}
+
+// Root jobs that fan out from inside a task, as a frame's job tree does.
+void NestedBench(Utils::SchedulingMode const &mode, Uint const &numThreads) {
+  Size const numRoots = 64;
+  Size const numChildren = 512;
+  Size const numTasks = numRoots * (numChildren + 1);
+  Atomic<Size> counter = 0;
+  Utils::Executor executor(numThreads, mode);
+  Double seconds = Measure([&]() {
+    for (Size i = 0; i < numRoots; ++i) {
+      executor.Schedule([&executor, &counter]() {
+        for (Size j = 0; j < numChildren; ++j) {
+          executor.Schedule([&counter]() { counter.fetch_add(1); });
+        }
+        counter.fetch_add(1);
+      });
+    }
+    while (counter.load() != numTasks) {
+      std::this_thread::yield();
+    }
+  });
+  Report("nested", mode, numThreads, numTasks, seconds);
+}
+
+void SchedulingModeBench() {
+  std::cout << "Scheduling Mode Bench" << std::endl;
+  std::cout << "---------------------" << std::endl;
+
+  for (Uint numThreads : {1u, 2u, 4u, 8u, 16u, 32u, 64u}) {
+    for (auto mode : {Utils::SchedulingMode::SingleQueue,
+                      Utils::SchedulingMode::WorkStealing}) {
+      FlatBench(mode, numThreads);
+      NestedBench(mode, numThreads);
+    }
+  }
+}
+
+// Several producer threads submitting at once, as render, audio and network
+// threads do.
+void InjectionBench(Uint const &numProducers) {
+  Size const numTasksPerProducer = 20000;
+  Size const numTasks = numTasksPerProducer * numProducers;
+  Atomic<Size> counter = 0;
+  Utils::Executor executor(4);
+  Double seconds = Measure([&]() {
+    Vec<Thread> producers;
+    for (Uint i = 0; i < numProducers; ++i) {
+      producers.emplace_back([&executor, &counter]() {
+        for (Size j = 0; j < numTasksPerProducer; ++j) {
+          executor.Schedule([&counter]() { counter.fetch_add(1); });
+        }
+      });
+    }
+    for (auto &producer : producers) {
+      producer.join();
+    }
+    while (counter.load() != numTasks) {
+      std::this_thread::yield();
+    }
+  });
+  std::cout << std::left << std::setw(10) << "inject" << std::setw(15)
+            << "producers" << std::right << std::setw(4) << numProducers
+            << std::setw(14) << std::fixed << std::setprecision(0)
+            << numTasks / seconds << " tasks/s" << std::endl;
+  RecordResult("inject/" + ToStr(numProducers), numTasks / seconds,
+               "tasks/s");
+}
+
+void InjectionQueueBench() {
+  std::cout << "Injection Queue Bench" << std::endl;
+  std::cout << "---------------------" << std::endl;
+
+  for (Uint numProducers : {1u, 2u, 4u, 8u}) {
+    InjectionBench(numProducers);
+  }
+}
+
+void ReportAllocations(Str const &name, Size const &numTasks,
+                       Size const &numAllocations, Double const &seconds) {
+  std::cout << std::left << std::setw(25) << name << std::right
+            << std::setw(14) << std::fixed << std::setprecision(0)
+            << numTasks / seconds << " tasks/s" << std::setw(10)
+            << std::setprecision(2)
+            << static_cast<Double>(numAllocations) / numTasks
+            << " allocs/task" << std::endl;
+  RecordResult(name, numTasks / seconds, "tasks/s");
+  RecordResult(name + "/allocs", static_cast<Double>(numAllocations) / numTasks,
+               "allocs/task");
+}
+
+// What every Schedule() cost before tasks were pooled: a std::function, a
+// packaged_task and a shared future state per job.
+void PackagedTaskBench() {
+  Size const numTasks = 200000;
+  Atomic<Size> counter = 0;
+  Size allocations = sNumAllocations.load();
+  Double seconds = Measure([&]() {
+    for (Size i = 0; i < numTasks; ++i) {
+      Utils::Runnable target = [&counter, i]() { counter.fetch_add(i & 1); };
+      PackagedTask<void()> task([target]() { target(); });
+      SharedFuture<void> future = task.get_future().share();
+      task();
+      future.wait();
+    }
+  });
+  ReportAllocations("packaged_task", numTasks,
+                    sNumAllocations.load() - allocations, seconds);
+}
+
+void PooledTaskBench() {
+  Size const numTasks = 200000;
+  Atomic<Size> counter = 0;
+  Utils::Executor executor(1);
+  // Warm the block pool so the steady state is measured.
+  for (Size i = 0; i < 1024; ++i) {
+    executor.Schedule([]() {});
+  }
+  executor.WaitForAll();
+
+  Size allocations = sNumAllocations.load();
+  Double seconds = Measure([&]() {
+    for (Size i = 0; i < numTasks; ++i) {
+      executor.Schedule([&counter, i]() { counter.fetch_add(i & 1); });
+    }
+    executor.WaitForAll();
+  });
+  ReportAllocations("executor (pooled)", numTasks,
+                    sNumAllocations.load() - allocations, seconds);
+}
+
+// Results come back through the task's own block instead of shared
+// captured state.
+void TypedResultBench() {
+  Size const numTasks = 200000;
+  Size const batch = 1000;
+  Utils::Executor executor(1);
+  Vec<Utils::TaskHandle<Size>> handles;
+  handles.reserve(batch);
+  for (Size i = 0; i < batch; ++i) {
+    handles.push_back(executor.Schedule([i]() { return i; }));
+  }
+  executor.WaitForAll();
+  handles.clear();
+
+  Size sum = 0;
+  Size allocations = sNumAllocations.load();
+  Double seconds = Measure([&]() {
+    for (Size i = 0; i < numTasks; i += batch) {
+      for (Size j = 0; j < batch; ++j) {
+        handles.push_back(executor.Schedule([j]() { return j * 2; }));
+      }
+      for (auto const &handle : handles) {
+        sum += handle.Get();
+      }
+      handles.clear();
+    }
+  });
+  ReportAllocations("executor (typed result)", numTasks,
+                    sNumAllocations.load() - allocations, seconds);
+}
+
+void TaskAllocationBench() {
+  std::cout << "Task Allocation Bench" << std::endl;
+  std::cout << "---------------------" << std::endl;
+
+  PackagedTaskBench();
+  PooledTaskBench();
+  TypedResultBench();
+}
+
+// A frame loop where the main thread submits jobs and waits for them. The
+// waiting thread runs jobs itself, so one fewer worker is spawned.
+void FrameWaitBench() {
+  std::cout << "Frame Wait Bench" << std::endl;
+  std::cout << "----------------" << std::endl;
+
+  Uint numWorkers = std::max(1u, std::thread::hardware_concurrency() - 1);
+  Utils::Executor executor(numWorkers);
+  Size const numFrames = 200;
+  Size const numJobs = 1000;
+  Atomic<Size> counter = 0;
+  Double seconds = Measure([&]() {
+    for (Size frame = 0; frame < numFrames; ++frame) {
+      for (Size i = 0; i < numJobs; ++i) {
+        executor.Schedule([&counter]() { counter.fetch_add(1); });
+      }
+      executor.WaitForAll();
+    }
+  });
+  std::cout << "frame time: " << std::fixed << std::setprecision(1)
+            << seconds / numFrames * 1e6 << " us (" << numJobs
+            << " jobs/frame, " << numWorkers << " workers + caller)"
+            << std::endl;
+  RecordResult("frame", seconds / numFrames * 1e6, "us");
+}
+
+void ParallelBench() {
+  std::cout << "Parallel Bench" << std::endl;
+  std::cout << "--------------" << std::endl;
+
+  Utils::Executor executor(std::max(1u, std::thread::hardware_concurrency()),
+                           Utils::SchedulingMode::WorkStealing);
+  auto map = [](Size i) { return std::sqrt(static_cast<Double>(i)); };
+  auto reduce = [](Double a, Double b) { return a + b; };
+
+  for (Size n = 1000u; n <= 100000000u; n *= 10u) {
+    Double serialSum = 0.0;
+    Double serial = Measure([&]() {
+      for (Size i = 0; i < n; ++i) {
+        serialSum = reduce(serialSum, map(i));
+      }
+    });
+    Double parallelSum = 0.0;
+    Double parallel = Measure([&]() {
+      parallelSum =
+          Utils::ParallelReduce(executor, {0u, n}, 0u, 0.0, map, reduce);
+    });
+
+    std::cout << "reduce n=" << std::left << std::setw(10) << n << std::right
+              << " serial " << std::setw(10) << std::fixed
+              << std::setprecision(1) << serial * 1e6 << " us  parallel "
+              << std::setw(10) << parallel * 1e6 << " us  speedup "
+              << std::setprecision(2) << serial / parallel
+              << (std::abs(serialSum - parallelSum) > 1e-6 * serialSum
+                      ? "  MISMATCH"
+                      : "")
+              << std::endl;
+  }
+
+  for (Size n = 1000u; n <= 10000000u; n *= 10u) {
+    Vec<Float> input(n, 2.0f);
+    Vec<Float> output(n);
+    Double serial = Measure([&]() {
+      for (Size i = 0; i < n; ++i) {
+        output[i] = std::sqrt(input[i]) * 3.0f;
+      }
+    });
+    Double parallel = Measure([&]() {
+      Utils::ParallelTransform(executor, input.begin(), input.end(),
+                               output.begin(),
+                               [](Float v) { return std::sqrt(v) * 3.0f; });
+    });
+
+    std::cout << "transform n=" << std::left << std::setw(10) << n
+              << std::right << " serial " << std::setw(10) << std::fixed
+              << std::setprecision(1) << serial * 1e6 << " us  parallel "
+              << std::setw(10) << parallel * 1e6 << " us  speedup "
+              << std::setprecision(2) << serial / parallel << std::endl;
+  }
+}
+
+Utils::Task<Size> HopStage(Utils::Executor &executor, Size value) {
+  co_await executor.Schedule();
+  co_return value;
+}
+
+Utils::Task<Size> PipelineStage(Utils::Executor &executor, Size numHops) {
+  Size sum = 0;
+  for (Size i = 0; i < numHops; ++i) {
+    sum += co_await HopStage(executor, i);
+  }
+  co_return sum;
+}
+
+void CoroutineBench() {
+  std::cout << "Coroutine Bench" << std::endl;
+  std::cout << "---------------" << std::endl;
+
+  Utils::Executor executor(std::max(1u, std::thread::hardware_concurrency()));
+
+  // A suspended stage costs its frame; a blocked thread costs its stack.
+  Size const numFrames = 1000;
+  Size bytes = sNumAllocatedBytes.load();
+  {
+    Vec<Utils::Task<Size>> stages;
+    stages.reserve(numFrames);
+    bytes = sNumAllocatedBytes.load();
+    for (Size i = 0; i < numFrames; ++i) {
+      stages.push_back(HopStage(executor, i));
+    }
+    bytes = sNumAllocatedBytes.load() - bytes;
+  }
+  std::cout << "bytes per suspended stage: " << bytes / numFrames << std::endl;
+
+  Size const numHops = 100000;
+  Double seconds = Measure([&]() {
+    Utils::SyncWait(executor, PipelineStage(executor, numHops));
+  });
+  std::cout << "hops: " << std::fixed << std::setprecision(0)
+            << numHops / seconds << " hops/s" << std::endl;
+}
+
+// Periodic short probes competing with a flood of long bulk jobs. Run once
+// with the probes in the bulk jobs' lane and once in the critical lane.
+void PriorityBench(Utils::TaskPriority const &priority) {
+  Utils::Executor executor(std::max(1u, std::thread::hardware_concurrency()));
+  executor.SetMetricsEnabled(true);
+  auto spin = [](Long const &micros) {
+    SteadyTimePoint end = Now() + chrono::microseconds(micros);
+    while (Now() < end) {
+    }
+  };
+
+  Size const numBulk = 2000;
+  Size const numProbes = 100;
+  for (Size i = 0; i < numBulk; ++i) {
+    executor.Schedule([&spin]() { spin(50); },
+                      {Utils::TaskPriority::Background});
+    if (i % (numBulk / numProbes) == 0) {
+      executor.Schedule([&spin]() { spin(1); }, {priority});
+    }
+  }
+  executor.WaitForAll();
+
+  // The background lane also holds the bulk jobs, so its numbers cover both.
+  Utils::LaneMetrics metrics = executor.GetLaneMetrics(priority);
+  std::cout << std::left << std::setw(12)
+            << (priority == Utils::TaskPriority::Critical ? "critical"
+                                                          : "background")
+            << std::right << "mean wait " << std::fixed
+            << std::setprecision(1) << metrics.MeanWait().count() / 1e3
+            << " us, max wait " << metrics.maxWait.count() / 1e3 << " us ("
+            << metrics.numTasks << " tasks)" << std::endl;
+}
+
+void PriorityLaneBench() {
+  std::cout << "Priority Lane Bench" << std::endl;
+  std::cout << "-------------------" << std::endl;
+
+  PriorityBench(Utils::TaskPriority::Background);
+  PriorityBench(Utils::TaskPriority::Critical);
+}
+
+// Thread start-up cost and nested throughput for each placement option.
+void PlacementBench(Str const &name, Utils::ExecutorOptions const &options) {
+  Size const numRoots = 64;
+  Size const numChildren = 512;
+  Size const numTasks = numRoots * (numChildren + 1);
+  Atomic<Size> counter = 0;
+
+  Double startup = Measure([&]() { Utils::Executor executor(options); });
+  Utils::Executor executor(options);
+  Double seconds = Measure([&]() {
+    for (Size i = 0; i < numRoots; ++i) {
+      executor.Schedule([&executor, &counter]() {
+        for (Size j = 0; j < numChildren; ++j) {
+          executor.Schedule([&counter]() { counter.fetch_add(1); });
+        }
+        counter.fetch_add(1);
+      });
+    }
+    while (counter.load() != numTasks) {
+      std::this_thread::yield();
+    }
+  });
+  std::cout << std::left << std::setw(10) << name << std::right
+            << std::setw(10) << std::fixed << std::setprecision(1)
+            << startup * 1e6 << " us start-up" << std::setw(14)
+            << std::setprecision(0) << numTasks / seconds << " tasks/s"
+            << std::endl;
+}
+
+void WorkerPlacementBench() {
+  std::cout << "Worker Placement Bench" << std::endl;
+  std::cout << "----------------------" << std::endl;
+
+  Utils::ExecutorOptions options;
+  options.mode = Utils::SchedulingMode::WorkStealing;
+  PlacementBench("default", options);
+  options.workerName = "TCBench";
+  PlacementBench("named", options);
+  options.pinWorkers = true;
+  PlacementBench("pinned", options);
+  options.pinWorkers = false;
+  options.groupByNumaNode = true;
+  PlacementBench("numa", options);
+  options.pinWorkers = true;
+  PlacementBench("numa+pin", options);
+}
+
+// Bursts of small jobs separated by idle gaps, as in a frame loop. Reports
+// how long a burst takes and what idling cost in wake-ups and spin time.
+void IdleBench(Str const &name, Utils::ExecutorOptions const &options) {
+  Size const numFrames = 200;
+  Size const numJobs = 64;
+  Utils::Executor executor(options);
+  Atomic<Size> counter = 0;
+  Double busy = 0.0;
+  for (Size frame = 0; frame < numFrames; ++frame) {
+    busy += Measure([&]() {
+      for (Size i = 0; i < numJobs; ++i) {
+        executor.Schedule([&counter]() { counter.fetch_add(1); });
+      }
+      // Wait without helping so the workers alone drain the burst.
+      while (counter.load() != (frame + 1) * numJobs) {
+        std::this_thread::yield();
+      }
+    });
+    std::this_thread::sleep_for(chrono::microseconds(500));
+  }
+
+  Utils::IdleMetrics metrics = executor.GetIdleMetrics();
+  std::cout << std::left << std::setw(10) << name << std::right
+            << std::setw(10) << std::fixed << std::setprecision(1)
+            << busy / numFrames * 1e6 << " us/burst" << std::setw(8)
+            << static_cast<Double>(metrics.numWakeups) / numFrames
+            << " wake-ups/frame"
+            << std::setw(10) << metrics.spinTime.count() / 1e3 / numFrames
+            << " us spin/frame" << std::endl;
+}
+
+void IdlePolicyBench() {
+  std::cout << "Idle Policy Bench" << std::endl;
+  std::cout << "-----------------" << std::endl;
+
+  Utils::ExecutorOptions options;
+  options.idleSpins = 0;
+  options.idleYields = 0;
+  IdleBench("park", options);
+  options.idleSpins = 4096;
+  options.idleYields = 64;
+  options.adaptiveIdle = false;
+  IdleBench("spin", options);
+  options.adaptiveIdle = true;
+  IdleBench("adaptive", options);
+}
+
+// Insert and cancel cost with many outstanding timers, then how late timers
+// fire.
+void TimerBench() {
+  std::cout << "Timer Bench" << std::endl;
+  std::cout << "-----------" << std::endl;
+
+  Utils::Executor executor(std::max(1u, std::thread::hardware_concurrency()));
+  for (Size numTimers : {10000u, 100000u, 1000000u}) {
+    Vec<Utils::Handle> handles;
+    handles.reserve(numTimers);
+    Double insert = Measure([&]() {
+      for (Size i = 0; i < numTimers; ++i) {
+        handles.push_back(executor.ScheduleAfter(
+            chrono::milliseconds(1000 + i % 60000), []() {}));
+      }
+    });
+    Double cancel = Measure([&]() {
+      for (auto const &handle : handles) {
+        executor.CancelTimer(handle);
+      }
+    });
+    std::cout << "timers=" << std::left << std::setw(9) << numTimers
+              << std::right << "insert " << std::fixed << std::setprecision(0)
+              << std::setw(6) << insert / numTimers * 1e9 << " ns  cancel "
+              << std::setw(6) << cancel / numTimers * 1e9 << " ns"
+              << std::endl;
+  }
+
+  Size const numFired = 10000;
+  Atomic<Long> totalLateness = 0;
+  Atomic<Long> maxLateness = 0;
+  for (Size i = 0; i < numFired; ++i) {
+    SteadyTimePoint due = Now() + chrono::microseconds(1000 + i * 10);
+    executor.ScheduleAt(due, [due, &totalLateness, &maxLateness]() {
+      Long lateness = DurationCast<NanoSec>(Now() - due).count();
+      totalLateness.fetch_add(lateness);
+      Long longest = maxLateness.load();
+      while (lateness > longest &&
+             !maxLateness.compare_exchange_weak(longest, lateness)) {
+      }
+    });
+  }
+  executor.WaitForAll();
+  std::cout << "lateness: mean " << std::fixed << std::setprecision(1)
+            << totalLateness.load() / 1e3 / numFired << " us, max "
+            << maxLateness.load() / 1e3 << " us" << std::endl;
+}
+
+void PinnedBench(Uint const &numProducers) {
+  Utils::ExecutorOptions options;
+  options.numWorkers = numProducers;
+  options.pinnedQueues = {"main"};
+  Utils::Executor executor(options);
+  ID main = executor.GetPinnedQueue("main");
+
+  Size const numTasks = 200000;
+  Size const perProducer = numTasks / numProducers;
+  Size counter = 0;
+  Double post = Measure([&]() {
+    for (Uint i = 0; i < numProducers; ++i) {
+      executor.Schedule([&]() {
+        for (Size j = 0; j < perProducer; ++j) {
+          executor.SchedulePinned(main, [&counter]() { ++counter; });
+        }
+      });
+    }
+    executor.WaitForAll();
+  });
+  Size numRun = 0;
+  Double pump = Measure([&]() { numRun = executor.PumpPinned(main); });
+
+  Size numPosted = perProducer * numProducers;
+  std::cout << "producers=" << std::left << std::setw(3) << numProducers
+            << std::right << "post " << std::fixed << std::setprecision(0)
+            << std::setw(6) << post / numPosted * 1e9 << " ns  pump "
+            << std::setw(6) << pump / numRun * 1e9 << " ns/task" << std::endl;
+}
+
+void PinnedQueueBench() {
+  std::cout << "Pinned Queue Bench" << std::endl;
+  std::cout << "------------------" << std::endl;
+  Uint maxProducers = std::max(1u, std::thread::hardware_concurrency());
+  for (Uint numProducers = 1; numProducers <= maxProducers;
+       numProducers *= 2) {
+    PinnedBench(numProducers);
+  }
+}
+
+void TraceBench() {
+  std::cout << "Trace Bench" << std::endl;
+  std::cout << "-----------" << std::endl;
+
+  if (!Utils::TaskTracer::IsCompiled()) {
+    std::cout << "built without TERREATECORE_EXECUTOR_TRACE" << std::endl;
+    return;
+  }
+
+  Utils::TaskTracer &tracer = Utils::TaskTracer::Instance();
+  Utils::Executor executor(std::max(1u, std::thread::hardware_concurrency()));
+  Utils::TaskOptions options;
+  options.label = "bench";
+  Size const numTasks = 500000;
+  for (Bool enabled : {false, true}) {
+    tracer.SetEnabled(enabled);
+    Double elapsed = Measure([&]() {
+      for (Size i = 0; i < numTasks; ++i) {
+        executor.Schedule([]() {}, options);
+      }
+      executor.WaitForAll();
+    });
+    std::cout << (enabled ? "enabled " : "disabled") << "  " << std::fixed
+              << std::setprecision(1) << elapsed / numTasks * 1e9
+              << " ns/task" << std::endl;
+    RecordResult(enabled ? "enabled" : "disabled", elapsed / numTasks * 1e9,
+                 "ns/task");
+  }
+  tracer.SetEnabled(true);
+
+  // The recording path on its own: three timestamps and one ring write,
+  // with the timestamps also measured alone since their cost depends on the
+  // machine (a virtualized cycle counter is several times slower).
+  Size const numEvents = 1000000;
+  Ulong sink = 0u;
+  Double stamps = Measure([&]() {
+    for (Size i = 0; i < numEvents; ++i) {
+      sink += Utils::TaskTracer::Timestamp();
+      sink += Utils::TaskTracer::Timestamp();
+      sink += Utils::TaskTracer::Timestamp();
+    }
+  });
+  Double record = Measure([&]() {
+    for (Size i = 0; i < numEvents; ++i) {
+      Utils::TraceEvent event;
+      event.label = "bench";
+      event.enqueued = static_cast<Long>(Utils::TaskTracer::Timestamp());
+      event.started = static_cast<Long>(Utils::TaskTracer::Timestamp());
+      event.finished = static_cast<Long>(Utils::TaskTracer::Timestamp());
+      tracer.Record(event);
+    }
+  });
+  std::cout << "record    " << std::fixed << std::setprecision(1)
+            << record / numEvents * 1e9 << " ns/event, of which timestamps "
+            << stamps / numEvents * 1e9 << " ns" << std::endl;
+  RecordResult("record", record / numEvents * 1e9, "ns/event");
+  RecordResult("timestamps", stamps / numEvents * 1e9, "ns/event");
+  tracer.Clear();
+  if (sink == 0u) {
+    std::cout << "unexpected sink" << std::endl;
+  }
+}
+
+// Time from Schedule() to the task starting and to the caller seeing it
+// finish. The caller spins instead of helping so workers do the running.
+void LatencyBench(Uint const &numWorkers) {
+  Utils::Executor executor(numWorkers);
+  Size const numSamples = 20000;
+  Vec<Long> startLatencies;
+  Vec<Long> completeLatencies;
+  startLatencies.reserve(numSamples);
+  completeLatencies.reserve(numSamples);
+  for (Size i = 0; i < numSamples; ++i) {
+    Atomic<Long> started = 0;
+    Atomic<Bool> done = false;
+    SteadyTimePoint scheduled = Now();
+    executor.Schedule([&started, &done]() {
+      started.store(DurationCast<NanoSec>(SinceEpoch()).count());
+      done.store(true, std::memory_order_release);
+    });
+    for (Uint spins = 0; !done.load(std::memory_order_acquire); ++spins) {
+      if (spins < 1000) {
+        Utils::CpuRelax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    Long origin = DurationCast<NanoSec>(scheduled.time_since_epoch()).count();
+    completeLatencies.push_back(
+        DurationCast<NanoSec>(Now() - scheduled).count());
+    startLatencies.push_back(started.load() - origin);
+  }
+  executor.WaitForAll();
+
+  auto percentile = [](Vec<Long> &samples, Double const &fraction) {
+    Size index = static_cast<Size>(fraction * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return static_cast<Double>(samples[index]);
+  };
+  for (Double fraction : {0.5, 0.99}) {
+    Str tag = fraction == 0.5 ? "p50" : "p99";
+    Double start = percentile(startLatencies, fraction);
+    Double complete = percentile(completeLatencies, fraction);
+    std::cout << "latency " << tag << "  workers=" << std::left
+              << std::setw(3) << numWorkers << std::right << " start "
+              << std::fixed << std::setprecision(0) << std::setw(8) << start
+              << " ns  complete " << std::setw(8) << complete << " ns"
+              << std::endl;
+    RecordResult("latency/start/" + tag + "/" + ToStr(numWorkers), start,
+                 "ns");
+    RecordResult("latency/complete/" + tag + "/" + ToStr(numWorkers),
+                 complete, "ns");
+  }
+}
+
+void EmptyTaskBench(Uint const &numWorkers) {
+  Utils::Executor executor(numWorkers);
+  Size const numTasks = 500000;
+  Double seconds = Measure([&]() {
+    for (Size i = 0; i < numTasks; ++i) {
+      executor.Schedule([]() {});
+    }
+    executor.WaitForAll();
+  });
+  std::cout << "empty     workers=" << std::left << std::setw(3) << numWorkers
+            << std::right << std::setw(14) << std::fixed
+            << std::setprecision(0) << numTasks / seconds << " tasks/s"
+            << std::endl;
+  RecordResult("empty/" + ToStr(numWorkers), numTasks / seconds, "tasks/s");
+}
+
+// One root fanning out to `width` children that all join into one task.
+void FanOutInBench(Uint const &numWorkers, Size const &width) {
+  Utils::Executor executor(numWorkers);
+  Size const numGraphs = std::max<Size>(10, 200000 / (width + 2));
+  Atomic<Size> counter = 0;
+  Vec<Utils::Handle> children;
+  children.reserve(width);
+  Double seconds = Measure([&]() {
+    for (Size graph = 0; graph < numGraphs; ++graph) {
+      Utils::Handle root = executor.Schedule([]() {});
+      for (Size i = 0; i < width; ++i) {
+        children.push_back(executor.Schedule(
+            [&counter]() { counter.fetch_add(1, std::memory_order_relaxed); },
+            {root}));
+      }
+      executor.Schedule([]() {}, children);
+      children.clear();
+    }
+    executor.WaitForAll();
+  });
+  std::cout << "fan-out/in workers=" << std::left << std::setw(3)
+            << numWorkers << " width=" << std::setw(5) << width
+            << std::right << std::setw(12) << std::fixed
+            << std::setprecision(0) << numGraphs / seconds << " graphs/s"
+            << std::endl;
+  RecordResult("fan/" + ToStr(width) + "/" + ToStr(numWorkers),
+               numGraphs / seconds, "graphs/s");
+}
+
+Size const sForSize = 4000000;
+Uint const sForPasses = 5;
+
+void ForBody(Vec<Float> &data, Size const &i) { data[i] = std::sqrt(data[i]); }
+
+Double SerialForBench() {
+  Vec<Float> data(sForSize, 1.0f);
+  Double seconds = Measure([&]() {
+    for (Uint pass = 0; pass < sForPasses; ++pass) {
+      for (Size i = 0; i < sForSize; ++i) {
+        ForBody(data, i);
+      }
+    }
+  });
+  std::cout << "serial for          " << std::setw(10) << std::fixed
+            << std::setprecision(1) << seconds * 1e3 << " ms" << std::endl;
+  RecordResult("serial_for", seconds * 1e3, "ms");
+  return seconds;
+}
+
+void ParallelForScalingBench(Uint const &numWorkers, Double const &baseline) {
+  Utils::Executor executor(numWorkers);
+  Vec<Float> data(sForSize, 1.0f);
+  Double seconds = Measure([&]() {
+    for (Uint pass = 0; pass < sForPasses; ++pass) {
+      Utils::ParallelFor(executor, {0u, sForSize}, 0u,
+                         [&data](Size i) { ForBody(data, i); });
+    }
+  });
+  Double speedup = baseline / seconds;
+  std::cout << "parallel_for workers=" << std::left << std::setw(3)
+            << numWorkers << std::right << std::setw(10) << std::fixed
+            << std::setprecision(1) << seconds * 1e3 << " ms  speedup "
+            << std::setprecision(2) << speedup << std::endl;
+  RecordResult("parallel_for/" + ToStr(numWorkers), seconds * 1e3, "ms");
+  RecordResult("parallel_for/speedup/" + ToStr(numWorkers), speedup, "x");
+}
+
+void ExecutorCoreBench() {
+  std::cout << "Executor Core Bench" << std::endl;
+  std::cout << "-------------------" << std::endl;
+
+  Uint maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+  Vec<Uint> workerCounts;
+  for (Uint n = 1; n < maxWorkers; n *= 2) {
+    workerCounts.push_back(n);
+  }
+  workerCounts.push_back(maxWorkers);
+
+  for (Uint numWorkers : workerCounts) {
+    LatencyBench(numWorkers);
+  }
+  for (Uint numWorkers : workerCounts) {
+    EmptyTaskBench(numWorkers);
+  }
+  for (Size width : {16u, 256u}) {
+    for (Uint numWorkers : workerCounts) {
+      FanOutInBench(numWorkers, width);
+    }
+  }
+  Double baseline = SerialForBench();
+  for (Uint numWorkers : workerCounts) {
+    ParallelForScalingBench(numWorkers, baseline);
+  }
+}
+
+// Tracking a batch of tasks with a handle each against one group counter.
+void TaskGroupBench() {
+  std::cout << "Task Group Bench" << std::endl;
+  std::cout << "----------------" << std::endl;
+
+  Utils::Executor executor(std::max(1u, std::thread::hardware_concurrency()));
+  Size const numTasks = 200000;
+  Atomic<Size> counter = 0;
+  Double handles = Measure([&]() {
+    Vec<Utils::Handle> pending;
+    pending.reserve(numTasks);
+    for (Size i = 0; i < numTasks; ++i) {
+      pending.push_back(executor.Schedule(
+          [&counter]() { counter.fetch_add(1, std::memory_order_relaxed); }));
+    }
+    for (auto const &handle : pending) {
+      executor.Wait(handle);
+    }
+  });
+  Double group = Measure([&]() {
+    Utils::TaskGroup tasks(executor);
+    for (Size i = 0; i < numTasks; ++i) {
+      tasks.Spawn(
+          [&counter]() { counter.fetch_add(1, std::memory_order_relaxed); });
+    }
+    tasks.Wait();
+  });
+
+  std::cout << "handles " << std::fixed << std::setprecision(0)
+            << std::setw(14) << numTasks / handles << " tasks/s" << std::endl;
+  std::cout << "group   " << std::setw(14) << numTasks / group << " tasks/s"
+            << std::endl;
+  RecordResult("handles", numTasks / handles, "tasks/s");
+  RecordResult("group", numTasks / group, "tasks/s");
+}
+
+// Bulk submission: one Schedule() per task against one ScheduleBatch().
+void ScheduleBatchBench() {
+  std::cout << "Schedule Batch Bench" << std::endl;
+  std::cout << "--------------------" << std::endl;
+
+  Utils::Executor executor(std::max(1u, std::thread::hardware_concurrency()));
+  Size const numRounds = 50;
+  Atomic<Size> counter = 0;
+  auto task = [&counter]() { counter.fetch_add(1, std::memory_order_relaxed); };
+  for (Size batchSize : {100u, 1000u, 10000u}) {
+    Vec<decltype(task)> batch(batchSize, task);
+    Double single = Measure([&]() {
+      for (Size round = 0; round < numRounds; ++round) {
+        for (Size i = 0; i < batchSize; ++i) {
+          executor.Schedule(task);
+        }
+        executor.WaitForAll();
+      }
+    });
+    Double batched = Measure([&]() {
+      for (Size round = 0; round < numRounds; ++round) {
+        executor.ScheduleBatch(batch);
+        executor.WaitForAll();
+      }
+    });
+
+    Size numTasks = batchSize * numRounds;
+    std::cout << "batch=" << std::left << std::setw(6) << batchSize
+              << std::right << " single " << std::fixed
+              << std::setprecision(0) << std::setw(10) << numTasks / single
+              << " tasks/s  batched " << std::setw(10) << numTasks / batched
+              << " tasks/s" << std::endl;
+    RecordResult("single/" + ToStr(batchSize), numTasks / single, "tasks/s");
+    RecordResult("batched/" + ToStr(batchSize), numTasks / batched,
+                 "tasks/s");
+  }
+}
+
+// Cost of leaving recording on: labelled empty tasks with and without it.
+void ReplayBench() {
+  std::cout << "Replay Bench" << std::endl;
+  std::cout << "------------" << std::endl;
+
+  Utils::Executor executor(std::max(1u, std::thread::hardware_concurrency()));
+  Utils::TaskOptions options;
+  options.label = "bench";
+  Size const numTasks = 200000;
+  for (Bool recording : {false, true}) {
+    if (recording) {
+      executor.StartRecording();
+    }
+    Double seconds = Measure([&]() {
+      for (Size i = 0; i < numTasks; ++i) {
+        executor.Schedule([]() {}, options);
+      }
+      executor.WaitForAll();
+    });
+    Size numBytes = recording ? executor.StopRecording().Encode().size() : 0u;
+    std::cout << (recording ? "recording" : "off      ") << std::fixed
+              << std::setprecision(1) << std::setw(10)
+              << seconds / numTasks * 1e9 << " ns/task";
+    if (recording) {
+      std::cout << std::setw(8) << std::setprecision(2)
+                << static_cast<Double>(numBytes) / numTasks << " bytes/task";
+    }
+    std::cout << std::endl;
+    RecordResult(recording ? "recording" : "off", seconds / numTasks * 1e9,
+                 "ns/task");
+  }
+}
+
+// Tasks building a temporary vector on the global heap or in their
+// worker's scratch arena.
+void ArenaBench() {
+  std::cout << "Arena Bench" << std::endl;
+  std::cout << "-----------" << std::endl;
+
+  Utils::Executor executor(std::max(1u, std::thread::hardware_concurrency()));
+  Size const numTasks = 100000;
+  Size const numElements = 256;
+  Atomic<Size> sink = 0;
+  auto heapTask = [&sink]() {
+    Vec<Size> scratch;
+    for (Size j = 0; j < numElements; ++j) {
+      scratch.push_back(j);
+    }
+    sink.fetch_add(scratch.back(), std::memory_order_relaxed);
+  };
+  auto arenaTask = [&sink]() {
+    Utils::ArenaVec<Size> scratch{
+        Utils::ArenaAllocator<Size>(Utils::Executor::CurrentArena())};
+    for (Size j = 0; j < numElements; ++j) {
+      scratch.push_back(j);
+    }
+    sink.fetch_add(scratch.back(), std::memory_order_relaxed);
+  };
+
+  for (Bool arena : {false, true}) {
+    // Warm the arenas and the block pool.
+    for (Size i = 0; i < 1000; ++i) {
+      arena ? (void)executor.Schedule(arenaTask)
+            : (void)executor.Schedule(heapTask);
+    }
+    executor.WaitForAll();
+
+    Size allocations = sNumAllocations.load();
+    Double seconds = Measure([&]() {
+      for (Size i = 0; i < numTasks; ++i) {
+        arena ? (void)executor.Schedule(arenaTask)
+              : (void)executor.Schedule(heapTask);
+      }
+      executor.WaitForAll();
+    });
+    ReportAllocations(arena ? "arena vector" : "heap vector", numTasks,
+                      sNumAllocations.load() - allocations, seconds);
+  }
+}
+
+// The subscriber list as Event kept it before: one mutex held while every
+// callback runs.
+struct LockedEvent {
+  Mutex mutex;
+  Vec<Function<void(Size)>> callbacks;
+
+  void Publish(Size value) {
+    LockGuard<Mutex> lock(mutex);
+    for (auto &callback : callbacks) {
+      callback(value);
+    }
+  }
+};
+
+template <typename EventType>
+Double PublishBench(EventType &event, Uint const &numPublishers,
+                    Size const &numPublishes) {
+  return Measure([&]() {
+    Vec<Thread> publishers;
+    for (Uint i = 0; i < numPublishers; ++i) {
+      publishers.emplace_back([&event, numPublishes]() {
+        for (Size j = 0; j < numPublishes; ++j) {
+          event.Publish(j);
+        }
+      });
+    }
+    for (auto &publisher : publishers) {
+      publisher.join();
+    }
+  });
+}
+
+void EventPublishBench() {
+  std::cout << "Event Publish Bench" << std::endl;
+  std::cout << "-------------------" << std::endl;
+
+  Size const numSubscribers = 4;
+  Size const numPublishesPerThread = 200000;
+  // Subscribers write to per-thread state so the list is what is measured.
+  auto subscriber = [](Size value) {
+    thread_local Size sink = 0u;
+    sink += value;
+  };
+  Utils::Event<Size> event;
+  LockedEvent locked;
+  for (Size i = 0; i < numSubscribers; ++i) {
+    event += subscriber;
+    locked.callbacks.push_back(subscriber);
+  }
+
+  for (Uint numPublishers : {1u, 2u, 4u, 8u, 16u, 32u}) {
+    Size numPublishes = numPublishesPerThread * numPublishers;
+    Double cow = PublishBench(event, numPublishers, numPublishesPerThread);
+    Double mutex = PublishBench(locked, numPublishers, numPublishesPerThread);
+    std::cout << std::left << std::setw(10) << "publish" << std::setw(11)
+              << "publishers" << std::right << std::setw(4) << numPublishers
+              << std::setw(14) << std::fixed << std::setprecision(0)
+              << numPublishes / cow << " /s" << std::setw(14)
+              << numPublishes / mutex << " /s (mutex)" << std::endl;
+    RecordResult("publish/" + ToStr(numPublishers), numPublishes / cow,
+                 "publishes/s");
+    RecordResult("publish-mutex/" + ToStr(numPublishers),
+                 numPublishes / mutex, "publishes/s");
+  }
+}
+
+// Cost of publishing to four subscribers synchronously versus queueing the
+// event and delivering the whole frame with one flush.
+void QueuedEventBench() {
+  std::cout << "Queued Event Bench" << std::endl;
+  std::cout << "------------------" << std::endl;
+
+  struct Contact {
+    Float position[3];
+    Float normal[3];
+    Float impulse;
+    Uint bodies[2];
+  };
+  Size const numSubscribers = 4;
+  Size const numPerFrame = 4096;
+  Size const numFrames = 200;
+  Size const numEvents = numPerFrame * numFrames;
+  Float sink = 0.0f;
+  auto subscriber = [&sink](Contact const &contact) {
+    sink += contact.impulse * contact.normal[1];
+  };
+  Utils::Event<Contact const &> event;
+  Utils::QueuedEvent<Contact const &> queued(numPerFrame);
+  for (Size i = 0; i < numSubscribers; ++i) {
+    event += subscriber;
+    queued += subscriber;
+  }
+
+  Contact contact{{1.0f, 2.0f, 3.0f}, {0.0f, 1.0f, 0.0f}, 0.5f, {1u, 2u}};
+  Double sync = Measure([&]() {
+    for (Size i = 0; i < numEvents; ++i) {
+      event.Publish(contact);
+    }
+  });
+  Double publish = 0.0;
+  Double flush = 0.0;
+  for (Size frame = 0; frame < numFrames; ++frame) {
+    publish += Measure([&]() {
+      for (Size i = 0; i < numPerFrame; ++i) {
+        queued.Publish(contact);
+      }
+    });
+    flush += Measure([&]() { queued.Flush(); });
+  }
+
+  std::cout << std::fixed << std::setprecision(1) << "sync publish"
+            << std::setw(10) << sync / numEvents * 1e9 << " ns/event"
+            << std::endl;
+  std::cout << "queued publish" << std::setw(8) << publish / numEvents * 1e9
+            << " ns/event" << std::endl;
+  std::cout << "queued flush" << std::setw(10) << flush / numEvents * 1e9
+            << " ns/event" << std::endl;
+  RecordResult("sync", sync / numEvents * 1e9, "ns/event");
+  RecordResult("queued-publish", publish / numEvents * 1e9, "ns/event");
+  RecordResult("queued-flush", flush / numEvents * 1e9, "ns/event");
+  if (sink == 0.0f) {
+    std::cout << "unexpected sink" << std::endl;
+  }
+}
+
+// Hundreds of subscribers doing real work, published serially and fanned
+// out across the executor.
+void PublishAsyncBench() {
+  std::cout << "Publish Async Bench" << std::endl;
+  std::cout << "-------------------" << std::endl;
+
+  Utils::Executor executor(std::max(1u, std::thread::hardware_concurrency()));
+  Size const numSubscribers = 512;
+  Size const numPublishes = 50;
+  Vec<Double> state(numSubscribers, 1.0);
+  Utils::Event<Double> event;
+  for (Size i = 0; i < numSubscribers; ++i) {
+    event += [&state, i](Double input) {
+      Double value = state[i];
+      for (int j = 0; j < 2000; ++j) {
+        value = std::sqrt(value + input);
+      }
+      state[i] = value;
+    };
+  }
+
+  Double serial = Measure([&]() {
+    for (Size i = 0; i < numPublishes; ++i) {
+      event.Publish(static_cast<Double>(i));
+    }
+  });
+  Double async = Measure([&]() {
+    for (Size i = 0; i < numPublishes; ++i) {
+      event.PublishAsync(executor, static_cast<Double>(i)).Get();
+    }
+  });
+  std::cout << std::fixed << std::setprecision(1) << "serial" << std::setw(12)
+            << serial / numPublishes * 1e6 << " us/publish" << std::endl;
+  std::cout << "async" << std::setw(13) << async / numPublishes * 1e6
+            << " us/publish (" << executor.GetNumWorkers() << " workers)"
+            << std::endl;
+  RecordResult("serial", serial / numPublishes * 1e6, "us/publish");
+  RecordResult("async", async / numPublishes * 1e6, "us/publish");
+}
+
+struct BenchSuite {
+  Str name;
+  void (*run)();
+};
+
+// usage: TCBench [--list] [--filter <substring>] [--json <path>]
+int main(int argc, char **argv) {
+  Vec<BenchSuite> suites = {
+      {"executor-core", ExecutorCoreBench},
+      {"scheduling-mode", SchedulingModeBench},
+      {"injection-queue", InjectionQueueBench},
+      {"task-allocation", TaskAllocationBench},
+      {"frame-wait", FrameWaitBench},
+      {"parallel", ParallelBench},
+      {"coroutine", CoroutineBench},
+      {"priority-lane", PriorityLaneBench},
+      {"worker-placement", WorkerPlacementBench},
+      {"idle-policy", IdlePolicyBench},
+      {"timer", TimerBench},
+      {"pinned-queue", PinnedQueueBench},
+      {"trace", TraceBench},
+      {"task-group", TaskGroupBench},
+      {"schedule-batch", ScheduleBatchBench},
+      {"replay", ReplayBench},
+      {"arena", ArenaBench},
+      {"event", EventPublishBench},
+      {"queued-event", QueuedEventBench},
+      {"publish-async", PublishAsyncBench},
+  };
+
+  Str filter;
+  Str jsonPath;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--list") == 0) {
+      for (auto const &suite : suites) {
+        std::cout << suite.name << std::endl;
+      }
+      return 0;
+    } else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--list] [--filter <substring>] [--json <path>]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  for (auto const &suite : suites) {
+    if (!filter.empty() && suite.name.find(filter) == Str::npos) {
+      continue;
+    }
+    sCurrentSuite = suite.name;
+    suite.run();
+    std::cout << std::endl;
+  }
+
+  if (!jsonPath.empty() && !WriteResults(jsonPath)) {
+    std::cerr << "Failed to write " << jsonPath << std::endl;
+    return 1;
+  }
+  return 0;
+}
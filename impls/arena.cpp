@@ -0,0 +1,41 @@
+#include "../includes/arena.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+ScratchArena::ScratchArena(Size const &chunkSize)
+    : mChunkSize(chunkSize > 0u ? chunkSize : 1u) {}
+
+Size ScratchArena::GetCapacity() const {
+  Size capacity = 0u;
+  for (auto const &chunk : mChunks) {
+    capacity += chunk.size;
+  }
+  return capacity;
+}
+
+void *ScratchArena::AllocateSlow(Size const &size, Size const &alignment) {
+  // Move on to the next kept chunk, or make room for one that fits. A chunk
+  // too small for this request is skipped rather than dropped.
+  Size required = size + alignment;
+  Size next = mChunks.empty() ? 0u : mChunk + 1;
+  while (next < mChunks.size() && mChunks[next].size < required) {
+    ++next;
+  }
+  if (next >= mChunks.size()) {
+    Size chunkSize = mChunks.empty() ? mChunkSize : mChunks.back().size * 2;
+    while (chunkSize < required) {
+      chunkSize *= 2;
+    }
+    Chunk chunk;
+    chunk.data.reset(new Ubyte[chunkSize]);
+    chunk.size = chunkSize;
+    mChunks.push_back(std::move(chunk));
+    next = mChunks.size() - 1;
+  }
+
+  mChunk = next;
+  mOffset = 0u;
+  return this->Allocate(size, alignment);
+}
+} // namespace TerreateCore::Utils
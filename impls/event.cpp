@@ -0,0 +1,30 @@
+#include "../includes/event.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+Subscription::Subscription(Subscription &&other) noexcept
+    : mSource(other.mSource), mIndex(other.mIndex),
+      mGeneration(other.mGeneration) {
+  other.mSource = nullptr;
+}
+
+void Subscription::Unsubscribe() {
+  if (mSource) {
+    SubscriptionSource *source = mSource;
+    mSource = nullptr;
+    source->Unsubscribe(mIndex, mGeneration);
+  }
+}
+
+Subscription &Subscription::operator=(Subscription &&other) noexcept {
+  if (this != &other) {
+    this->Unsubscribe();
+    mSource = other.mSource;
+    mIndex = other.mIndex;
+    mGeneration = other.mGeneration;
+    other.mSource = nullptr;
+  }
+  return *this;
+}
+} // namespace TerreateCore::Utils
@@ -1,105 +1,1274 @@
 #include "../includes/executor.hpp"
 #include "../includes/exceptions.hpp"
+#include "../includes/thread.hpp"
+#include "../includes/trace.hpp"
+
+#include <algorithm>
 
 namespace TerreateCore::Utils {
 using namespace TerreateCore::Defines;
 
-void Executor::Worker() {
+thread_local Executor *Executor::sCurrentExecutor = nullptr;
+thread_local Uint Executor::sWorkerIndex = 0u;
+thread_local Uint Executor::sNumPicks = 0u;
+thread_local ScratchArena *Executor::sArena = nullptr;
+thread_local Executor::ReplayCache Executor::sReplayCache;
+Atomic<Ulong> Executor::sNumReplayGenerations = 0u;
+
+void Executor::Worker(Uint const &index) {
+  sCurrentExecutor = this;
+  sWorkerIndex = index;
+  sArena = mArenas[index].get();
+  if (!mWorkerCpus[index].empty()) {
+    SetThreadAffinity(mWorkerCpus[index]);
+  }
+  if (!mWorkerName.empty()) {
+    SetThreadName(mWorkerName + "-" + ToStr(index));
+  }
+#ifdef TERREATECORE_EXECUTOR_TRACE
+  TaskTracer::Instance().SetThreadName(
+      (mWorkerName.empty() ? Str("worker") : mWorkerName) + "-" +
+      ToStr(index));
+#endif
+
+  Uint spinLimit = mIdleSpins;
+  Bool woken = false;
   while (true) {
-    Task task;
-    {
-      UniqueLock<Mutex> lock(mQueueMutex);
-      mCV.wait(lock, [this] { return !mTaskQueue.empty() || mStop; });
+    TaskBlock *block = nullptr;
+    if (this->TryPop(block)) {
+      if (woken) {
+        // Wake-ups are coalesced, so a woken worker that found work passes
+        // the wake-up on in case more of the burst is queued.
+        this->Wake();
+        woken = false;
+      }
+      this->Execute(block);
+      continue;
+    }
+
+    if (mStop.load() && !this->HasWork()) {
+      return;
+    }
+    if (this->Spin(spinLimit, block)) {
+      this->Execute(block);
+      continue;
+    }
+    if (mReplayMode.load(std::memory_order_relaxed) == ReplayMode::Replay &&
+        this->ResolveReplayStall()) {
+      continue;
+    }
+    woken = this->Park();
+  }
+}
+
+void Executor::Submit(TaskBlock *block) {
+  block->SetExecutor(this);
+  // Count the job before it becomes visible so a thief can never finish it
+  // ahead of the increment.
+  mNumJobs.fetch_add(1);
+  this->Enqueue(block);
+}
+
+void Executor::SubmitAfter(TaskBlock *block, Vec<Handle> const &dependencies) {
+  block->SetExecutor(this);
+  mNumJobs.fetch_add(1);
+
+  // Hold one dependency ourselves so the task cannot be released while the
+  // rest are still being registered.
+  block->AddDependency();
+  for (auto const &dependency : dependencies) {
+    if (dependency.Valid()) {
+      dependency.mBlock->AddSuccessor(block);
+    }
+  }
+  if (block->ReleaseDependency()) {
+    this->Enqueue(block);
+  }
+}
 
-      if (mStop && mTaskQueue.empty()) {
-        return;
+void Executor::SubmitAt(TaskBlock *block, SteadyTimePoint const &time) {
+  block->SetExecutor(this);
+  mNumJobs.fetch_add(1);
+
+  Bool stopped = false;
+  Bool inserted = false;
+  Bool wake = false;
+  {
+    LockGuard<Mutex> lock(mTimerMutex);
+    if (mTimerStop) {
+      stopped = true;
+    } else {
+      if (!mTimerThread.joinable()) {
+        mTimerThread = Thread(&Executor::TimerLoop, this);
       }
+      inserted = mTimers.Insert(block, time);
+      wake = inserted && time < mTimerWakeAt;
+    }
+  }
+  if (stopped) {
+    // The executor is shutting down and the timer would never fire.
+    block->Cancel();
+    this->Execute(block);
+  } else if (!inserted) {
+    // Already due.
+    this->Enqueue(block);
+  } else if (wake) {
+    mTimerCondition.notify_one();
+  }
+}
+
+void Executor::TimerLoop() {
+  Vec<TaskBlock *> expired;
+  UniqueLock<Mutex> lock(mTimerMutex);
+  while (!mTimerStop) {
+    mTimers.Advance(Now(), expired);
+    if (!expired.empty()) {
+      lock.unlock();
+      for (TaskBlock *block : expired) {
+        this->Enqueue(block);
+      }
+      expired.clear();
+      lock.lock();
+      continue;
+    }
+
+    mTimerWakeAt = mTimers.GetNextExpiry();
+    if (mTimerWakeAt == SteadyTimePoint::max()) {
+      mTimerCondition.wait(lock);
+    } else {
+      mTimerCondition.wait_until(lock, mTimerWakeAt);
+    }
+  }
+}
+
+void Executor::StopTimers() {
+  {
+    LockGuard<Mutex> lock(mTimerMutex);
+    mTimerStop = true;
+  }
+  mTimerCondition.notify_all();
+  if (mTimerThread.joinable()) {
+    mTimerThread.join();
+  }
+
+  // Timers that never fired are dropped, but their successors still run.
+  Vec<TaskBlock *> pending;
+  mTimers.Clear(pending);
+  for (TaskBlock *block : pending) {
+    block->Cancel();
+    this->Execute(block);
+  }
+}
+
+void Executor::SubmitPinned(ID const &queue, TaskBlock *block) {
+  if (queue >= mPinnedQueues.size()) {
+    block->Cancel();
+    block->Release();
+    throw Exceptions::ExecutorError("Pinned queue does not exist.");
+  }
+
+  block->SetExecutor(this);
+  if (mStop.load()) {
+    // Nobody pumps the queue once the executor is going away.
+    block->Cancel();
+    this->RunBlock(block);
+    return;
+  }
+  Atomic<TaskBlock *> &incoming = mPinnedQueues[queue]->incoming;
+  TaskBlock *head = incoming.load(std::memory_order_relaxed);
+  do {
+    block->SetNext(head);
+  } while (!incoming.compare_exchange_weak(head, block,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed));
+  // The owner may be parked in a wait on this executor.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  this->WakeWaiters();
+}
 
-      task = std::move(mTaskQueue.front());
-      mTaskQueue.pop();
+TaskBlock *Executor::PopPinned(PinnedQueue &queue) {
+  if (queue.pending == nullptr) {
+    // Producers push newest first, so reverse the batch into FIFO order.
+    TaskBlock *list = queue.incoming.exchange(nullptr, std::memory_order_acquire);
+    while (list) {
+      TaskBlock *next = list->GetNext();
+      list->SetNext(queue.pending);
+      queue.pending = list;
+      list = next;
+    }
+  }
+
+  TaskBlock *block = queue.pending;
+  if (block) {
+    queue.pending = block->GetNext();
+    block->SetNext(nullptr);
+  }
+  return block;
+}
+
+Bool Executor::TryRunPinned() {
+  std::thread::id self = std::this_thread::get_id();
+  for (auto &queue : mPinnedQueues) {
+    if (queue->owner.load(std::memory_order_relaxed) != self) {
+      continue;
+    }
+    if (TaskBlock *block = this->PopPinned(*queue)) {
+      this->RunBlock(block);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      this->WakeWaiters();
+      return true;
     }
+  }
+  return false;
+}
 
-    task();
+Bool Executor::HasPinnedWork() const {
+  std::thread::id self = std::this_thread::get_id();
+  for (auto const &queue : mPinnedQueues) {
+    if (queue->owner.load(std::memory_order_relaxed) == self &&
+        (queue->pending != nullptr || queue->incoming.load() != nullptr)) {
+      return true;
+    }
+  }
+  return false;
+}
 
-    if (mNumJobs.fetch_sub(1) == 1) {
-      mComplete.store(true);
-      mComplete.notify_all();
+void Executor::DropPinned() {
+  for (auto &queue : mPinnedQueues) {
+    while (TaskBlock *block = this->PopPinned(*queue)) {
+      block->Cancel();
+      this->RunBlock(block);
     }
   }
 }
 
-Executor::Executor(Uint const &numWorkers) {
+void Executor::Stamp(TaskBlock *block) {
+  if (mMetricsEnabled.load(std::memory_order_relaxed)) {
+    block->SetQueuedAt(Now());
+  }
+#ifdef TERREATECORE_EXECUTOR_TRACE
+  if (TaskTracer::Instance().IsEnabled()) {
+    block->SetTracedAt(TaskTracer::Timestamp());
+  }
+#endif
+}
+
+void Executor::SubmitBatch(Vec<TaskBlock *> &blocks) {
+  if (blocks.empty()) {
+    return;
+  }
+
+  Size count = blocks.size();
+  for (TaskBlock *block : blocks) {
+    block->SetExecutor(this);
+  }
+  mNumJobs.fetch_add(count);
+
+  // Recording and replay have to see every labelled block on its own.
+  if (blocks.front()->GetOptions().label &&
+      mReplayMode.load(std::memory_order_relaxed) != ReplayMode::Off) {
+    for (TaskBlock *block : blocks) {
+      this->Enqueue(block);
+    }
+    return;
+  }
+  for (TaskBlock *block : blocks) {
+    this->Stamp(block);
+  }
+
+  // Every block of a batch shares its options and so its lane.
+  TaskOptions const &options = blocks.front()->GetOptions();
+  if (options.HasDeadline()) {
+    this->PushDeadline(blocks.data(), count);
+    this->WakeMany(count);
+    return;
+  }
+
+  Uint lane = static_cast<Uint>(options.priority);
+  if (options.priority == TaskPriority::Critical) {
+    mNumCriticalTasks.fetch_add(count);
+  }
+
+  if (mMode == SchedulingMode::WorkStealing && sCurrentExecutor == this) {
+    mLocalQueues[sWorkerIndex * sNumLanes + lane]->PushBatch(blocks.data(),
+                                                             count);
+    this->WakeMany(count);
+    return;
+  }
+
+  Size numPushed = 0u;
+  while (numPushed < count) {
+    Size numNew = mInjectQueues[lane]->TryPushBatch(blocks.data() + numPushed,
+                                                    count - numPushed);
+    numPushed += numNew;
+    if (numPushed < count) {
+      // Full: get the workers going on what is queued and help drain it.
+      if (numNew > 0) {
+        this->WakeMany(numNew);
+      }
+      if (!this->TryRunOne()) {
+        std::this_thread::yield();
+      }
+    }
+  }
+  this->WakeMany(count);
+}
+
+void Executor::Enqueue(TaskBlock *block) {
+  this->Stamp(block);
+  if (block->GetOptions().label &&
+      mReplayMode.load(std::memory_order_relaxed) != ReplayMode::Off &&
+      this->HoldForReplay(block)) {
+    return;
+  }
+
+  TaskOptions const &options = block->GetOptions();
+  if (options.HasDeadline()) {
+    this->PushDeadline(&block, 1u);
+    this->Wake();
+    return;
+  }
+
+  Uint lane = static_cast<Uint>(options.priority);
+  if (options.priority == TaskPriority::Critical) {
+    mNumCriticalTasks.fetch_add(1);
+  }
+
+  if (mMode == SchedulingMode::WorkStealing && sCurrentExecutor == this) {
+    mLocalQueues[sWorkerIndex * sNumLanes + lane]->Push(block);
+    this->Wake();
+    return;
+  }
+
+  while (!mInjectQueues[lane]->TryPush(std::move(block))) {
+    // The queue is bounded. Rather than blocking the producer, help drain it.
+    if (!this->TryRunOne()) {
+      std::this_thread::yield();
+    }
+  }
+  this->Wake();
+}
+
+void Executor::Execute(TaskBlock *block) {
+  this->RunBlock(block);
+  if (mNumJobs.fetch_sub(1) == 1) {
+    mNumJobs.notify_all();
+  }
+  // The task may have completed what a parked waiter is waiting for.
+  if (mNumParkedWaiters.load() != 0) {
+    this->WakeWaiters();
+  }
+}
+
+void Executor::RunBlock(TaskBlock *block) {
+  // Past this point the task either runs or is dropped here, so the token
+  // no longer needs to reach it.
+  block->DetachToken();
+  if (block->GetOptions().token.IsCancelled()) {
+    block->Cancel();
+  }
+
+  if (!block->Done() && block->GetQueuedAt() != SteadyTimePoint()) {
+    this->RecordWait(block);
+  }
+
+#ifdef TERREATECORE_EXECUTOR_TRACE
+  TaskTracer &tracer = TaskTracer::Instance();
+  TraceEvent event;
+  Bool traced = tracer.IsEnabled() && !block->Done();
+  if (traced) {
+    event.started = static_cast<Long>(TaskTracer::Timestamp());
+  }
+#endif
+  if (block->GetReplayKey() != 0u &&
+      mReplayMode.load(std::memory_order_relaxed) == ReplayMode::Record) {
+    this->RecordReplay(block);
+  }
+  // Rewinding rather than resetting keeps the arena of a task that is
+  // waiting on this one intact.
+  ScratchArena *arena = nullptr;
+  ScratchArena::Marker marker;
+  if (mArenaReset == ArenaReset::PerTask) {
+    arena = &CurrentArena();
+    marker = arena->GetMarker();
+  }
+  // Cancelled tasks only go through the bookkeeping below.
+  Bool ran = block->Run();
+  if (arena) {
+    arena->Rewind(marker);
+  }
+  if (block->GetReplayKey() != 0u &&
+      mReplayMode.load(std::memory_order_relaxed) == ReplayMode::Replay) {
+    this->FinishReplay(block);
+  }
+#ifdef TERREATECORE_EXECUTOR_TRACE
+  if (traced && ran) {
+    event.finished = static_cast<Long>(TaskTracer::Timestamp());
+    event.enqueued = block->GetTracedAt() == 0u
+                         ? event.started
+                         : static_cast<Long>(block->GetTracedAt());
+    event.label = block->GetOptions().label;
+    event.worker = sCurrentExecutor == this ? sWorkerIndex
+                                            : TraceEvent::sNoWorker;
+    tracer.Record(event);
+  }
+#endif
+  if (ran) {
+    TaskOptions const &options = block->GetOptions();
+    if (options.HasDeadline() && Now() > options.deadline) {
+      mLaneCounters[static_cast<Uint>(options.priority)]
+          .numMissedDeadlines.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (block->GetException()) {
+      ExceptionPtr error = block->GetException();
+      if (!mErrors.TryPush(std::move(error))) {
+        mNumDroppedErrors.fetch_add(1);
+      }
+    }
+  }
+  block->ReleaseSuccessors([](TaskBlock *successor) {
+    successor->GetExecutor()->Enqueue(successor);
+  });
+  // The executor's reference goes away as soon as the task is done, so the
+  // block is recycled once the caller drops its handle too.
+  block->Release();
+}
+
+void Executor::RecordWait(TaskBlock const *block) {
+  Long wait = DurationCast<NanoSec>(Now() - block->GetQueuedAt()).count();
+  LaneCounters &counters =
+      mLaneCounters[static_cast<Uint>(block->GetOptions().priority)];
+  counters.numTasks.fetch_add(1, std::memory_order_relaxed);
+  counters.totalWait.fetch_add(wait, std::memory_order_relaxed);
+  Long longest = counters.maxWait.load(std::memory_order_relaxed);
+  while (wait > longest && !counters.maxWait.compare_exchange_weak(
+                               longest, wait, std::memory_order_relaxed)) {
+  }
+}
+
+Bool Executor::TryPop(TaskBlock *&block) {
+  if (mReplayReady.load(std::memory_order_relaxed) &&
+      this->TryPopReplay(block)) {
+    return true;
+  }
+
+  // Within each lane, deadline tasks go first.
+  Uint const critical = static_cast<Uint>(TaskPriority::Critical);
+  if (this->TryPopDeadline(critical, block)) {
+    return true;
+  }
+  if (mNumCriticalTasks.load(std::memory_order_relaxed) > 0 &&
+      this->TryPopLane(critical, block)) {
+    mNumCriticalTasks.fetch_sub(1);
+    return true;
+  }
+
+  // Fairness only ever reorders normal and background work; critical work
+  // never waits behind either.
+  Uint const normal = static_cast<Uint>(TaskPriority::Normal);
+  Uint const background = static_cast<Uint>(TaskPriority::Background);
+  if (++sNumPicks % sFairnessInterval == 0) {
+    return this->TryPopDeadline(background, block) ||
+           this->TryPopLane(background, block) ||
+           this->TryPopDeadline(normal, block) ||
+           this->TryPopLane(normal, block);
+  }
+  return this->TryPopDeadline(normal, block) ||
+         this->TryPopLane(normal, block) ||
+         this->TryPopDeadline(background, block) ||
+         this->TryPopLane(background, block);
+}
+
+void Executor::PushDeadline(TaskBlock *const *blocks, Size const &count) {
+  // The blocks of one submission share their options and so their lane.
+  Uint lane = static_cast<Uint>(blocks[0]->GetOptions().priority);
+  DeadlineQueue &queue = *mDeadlineQueues[lane];
+  LockGuard<Mutex> lock(queue.mutex);
+  for (Size i = 0; i < count; ++i) {
+    queue.blocks.push(blocks[i]);
+  }
+  queue.numTasks.fetch_add(count);
+}
+
+Bool Executor::TryPopDeadline(Uint const &lane, TaskBlock *&block) {
+  DeadlineQueue &queue = *mDeadlineQueues[lane];
+  if (queue.numTasks.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+  LockGuard<Mutex> lock(queue.mutex);
+  if (queue.blocks.empty()) {
+    return false;
+  }
+  block = queue.blocks.top();
+  queue.blocks.pop();
+  queue.numTasks.fetch_sub(1);
+  return true;
+}
+
+Bool Executor::TryPopLane(Uint const &lane, TaskBlock *&block) {
+  if (mMode != SchedulingMode::WorkStealing) {
+    return mInjectQueues[lane]->TryPop(block);
+  }
+
+  Uint numQueues = static_cast<Uint>(mLocalQueues.size() / sNumLanes);
+  if (sCurrentExecutor == this) {
+    return mLocalQueues[sWorkerIndex * sNumLanes + lane]->Pop(block) ||
+           mInjectQueues[lane]->TryPop(block) ||
+           this->TrySteal(sWorkerIndex, lane, block);
+  }
+  return mInjectQueues[lane]->TryPop(block) ||
+         this->TrySteal(numQueues, lane, block);
+}
+
+Bool Executor::TrySteal(Uint const &index, Uint const &lane,
+                        TaskBlock *&block) {
+  Uint numQueues = static_cast<Uint>(mLocalQueues.size() / sNumLanes);
+  if (index < numQueues) {
+    for (Uint victim : mStealOrder[index]) {
+      if (mLocalQueues[victim * sNumLanes + lane]->Steal(block)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Any index past the last worker steals from every deque.
+  for (Uint victim = 0; victim < numQueues; ++victim) {
+    if (mLocalQueues[victim * sNumLanes + lane]->Steal(block)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Bool Executor::TryRunOne() {
+  TaskBlock *block = nullptr;
+  if (this->TryPop(block)) {
+    this->Execute(block);
+    return true;
+  }
+  // A thread that owns pinned queues serves them while it waits.
+  return sCurrentExecutor != this && !mPinnedQueues.empty() &&
+         this->TryRunPinned();
+}
+
+Bool Executor::HasWork() const {
+  if (this->HasReplayWork()) {
+    return true;
+  }
+  for (auto const &queue : mDeadlineQueues) {
+    if (queue->numTasks.load() > 0) {
+      return true;
+    }
+  }
+  for (auto const &queue : mInjectQueues) {
+    if (!queue->Empty()) {
+      return true;
+    }
+  }
+  for (auto const &queue : mLocalQueues) {
+    if (!queue->Empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Bool Executor::Spin(Uint &spinLimit, TaskBlock *&block) {
+  if (spinLimit == 0 && mIdleYields == 0) {
+    return false;
+  }
+
+  SteadyTimePoint start = Now();
+  // Producers skip the wake-up while someone is spinning; see Wake().
+  mNumSpinning.fetch_add(1);
+  Bool found = false;
+  for (Uint i = 0; i < spinLimit && !found && !mStop.load(); ++i) {
+    CpuRelax();
+    found = this->TryPop(block);
+  }
+  for (Uint i = 0; i < mIdleYields && !found && !mStop.load(); ++i) {
+    std::this_thread::yield();
+    found = this->TryPop(block);
+  }
+  mNumSpinning.fetch_sub(1);
+
+  if (found) {
+    // A burst rarely comes alone. Hand the next wake-up on so the rest of it
+    // is not left to this worker only.
+    this->Wake();
+  }
+  if (mAdaptiveIdle) {
+    if (found) {
+      spinLimit = std::min(mIdleSpins, std::max(1u, spinLimit * 2));
+    } else {
+      spinLimit = std::max(mIdleSpins / 16, spinLimit / 2);
+    }
+  }
+
+  mIdleCounters.numSpins.fetch_add(1, std::memory_order_relaxed);
+  if (found) {
+    mIdleCounters.numSpinHits.fetch_add(1, std::memory_order_relaxed);
+  }
+  mIdleCounters.spinTime.fetch_add(
+      DurationCast<NanoSec>(Now() - start).count(), std::memory_order_relaxed);
+  return found;
+}
+
+Bool Executor::Park() {
+  Uint epoch = mWakeEpoch.load();
+  mNumSleeping.fetch_add(1);
+  // A pending wake-up may have been meant for a worker that never went to
+  // sleep. Clearing it before the fence means a producer that skipped its
+  // wake-up because of it has its task seen by the check below.
+  mWakePending.store(false);
+  // Pairs with the fence in Wake(): either the producer sees this sleeper or
+  // this check sees the producer's task.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  Bool parked = false;
+  if (!this->HasWork() && !mStop.load()) {
+    mIdleCounters.numParks.fetch_add(1, std::memory_order_relaxed);
+    mWakeEpoch.wait(epoch);
+    mWakePending.store(false);
+    parked = true;
+  }
+  mNumSleeping.fetch_sub(1);
+  return parked;
+}
+
+void Executor::Wake() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  this->WakeWaiters();
+  // A spinning worker will pick the task up, and one that gives up goes
+  // through Park(), which checks for work again after the same fence. A
+  // pending wake-up already has a worker on its way.
+  if (mNumSpinning.load(std::memory_order_relaxed) == 0 &&
+      mNumSleeping.load(std::memory_order_relaxed) > 0 &&
+      !mWakePending.exchange(true)) {
+    mIdleCounters.numWakeups.fetch_add(1, std::memory_order_relaxed);
+    mWakeEpoch.fetch_add(1);
+    mWakeEpoch.notify_one();
+  }
+}
+
+void Executor::WakeMany(Size const &count) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  this->WakeWaiters();
+  Size numSpinning = mNumSpinning.load(std::memory_order_relaxed);
+  Size numSleeping = mNumSleeping.load(std::memory_order_relaxed);
+  if (count <= numSpinning || numSleeping == 0) {
+    return;
+  }
+
+  // Spinning workers take their share; wake as many sleepers as there are
+  // tasks left over with a single epoch bump.
+  Size numWake = std::min(count - numSpinning, numSleeping);
+  mWakePending.store(true);
+  mIdleCounters.numWakeups.fetch_add(numWake, std::memory_order_relaxed);
+  mWakeEpoch.fetch_add(1);
+  if (numWake >= numSleeping) {
+    mWakeEpoch.notify_all();
+  } else {
+    for (Size i = 0; i < numWake; ++i) {
+      mWakeEpoch.notify_one();
+    }
+  }
+}
+
+void Executor::WakeWaiters() {
+  // Waiters run any task, so all of them look rather than one.
+  if (mNumParkedWaiters.load(std::memory_order_relaxed) != 0) {
+    mWaitEpoch.fetch_add(1);
+    mWaitEpoch.notify_all();
+  }
+}
+
+void Executor::PlaceWorkers(ExecutorOptions const &options) {
+  Uint numWorkers = options.numWorkers;
+  mWorkerCpus.assign(numWorkers, {});
+  Vec<Uint> nodeOf(numWorkers, 0u);
+
+  if (options.pinWorkers || options.groupByNumaNode) {
+    Vec<Vec<Uint>> nodes = GetNumaNodes();
+    Map<Uint, Uint> cpuNodes;
+    Vec<Uint> cpus;
+    for (Uint node = 0; node < nodes.size(); ++node) {
+      for (Uint cpu : nodes[node]) {
+        cpuNodes[cpu] = node;
+        cpus.push_back(cpu);
+      }
+    }
+    if (!options.cpus.empty()) {
+      cpus = options.cpus;
+    }
+
+    for (Uint i = 0; i < numWorkers; ++i) {
+      Uint cpu = cpus[i % cpus.size()];
+      nodeOf[i] = cpuNodes.contains(cpu) ? cpuNodes[cpu] : 0u;
+      if (options.pinWorkers) {
+        mWorkerCpus[i] = {cpu};
+      } else {
+        mWorkerCpus[i] = nodes[nodeOf[i]];
+      }
+    }
+  }
+
+  // Neighbours on the same node come first, each list starting after the
+  // worker itself so thieves spread over different victims.
+  mStealOrder.assign(numWorkers, {});
+  for (Uint i = 0; i < numWorkers; ++i) {
+    Vec<Uint> remote;
+    for (Uint offset = 1; offset < numWorkers; ++offset) {
+      Uint victim = (i + offset) % numWorkers;
+      if (!options.groupByNumaNode || nodeOf[victim] == nodeOf[i]) {
+        mStealOrder[i].push_back(victim);
+      } else {
+        remote.push_back(victim);
+      }
+    }
+    mStealOrder[i].insert(mStealOrder[i].end(), remote.begin(), remote.end());
+  }
+}
+
+Executor::Executor(Uint const &numWorkers, SchedulingMode const &mode)
+    : Executor(ExecutorOptions{numWorkers, mode}) {}
+
+Executor::Executor(ExecutorOptions const &options)
+    : mErrors(sErrorChannelCapacity), mMode(options.mode),
+      mReplayOccurrences(sMaxReplayLabels), mWorkerName(options.workerName),
+      mIdleSpins(options.idleSpins), mIdleYields(options.idleYields),
+      mAdaptiveIdle(options.adaptiveIdle), mArenaReset(options.arenaReset) {
+  Uint numWorkers = options.numWorkers;
   if (numWorkers == 0) {
     throw Exceptions::ExecutorError(
         "Number of workers must be greater than 0.");
   }
 
+  this->PlaceWorkers(options);
+  for (Uint lane = 0; lane < sNumLanes; ++lane) {
+    mInjectQueues.emplace_back(
+        new MPMCQueue<TaskBlock *>(sInjectQueueCapacity));
+    mDeadlineQueues.emplace_back(new DeadlineQueue());
+  }
+  if (mMode == SchedulingMode::WorkStealing) {
+    for (Uint i = 0; i < numWorkers * sNumLanes; ++i) {
+      mLocalQueues.emplace_back(new WorkStealingDeque<TaskBlock *>());
+    }
+  }
+
+  for (auto const &name : options.pinnedQueues) {
+    mPinnedQueues.emplace_back(new PinnedQueue());
+    mPinnedQueues.back()->name = name;
+  }
+
+  for (Uint i = 0; i < numWorkers; ++i) {
+    mArenas.emplace_back(new ScratchArena(options.arenaSize));
+  }
+
   for (Uint i = 0; i < numWorkers; ++i) {
-    mWorkers.emplace_back(&Executor::Worker, this);
+    mWorkers.emplace_back(&Executor::Worker, this, i);
   }
 }
 
 Executor::~Executor() {
-  {
-    LockGuard<Mutex> lock(mQueueMutex);
-    mStop.store(true);
-  }
-  mCV.notify_all();
+  this->StopReplay();
+  mStop.store(true);
+  // Workers are still running, so successors of the cancelled timers and
+  // pinned tasks run, and tasks scheduling new timers or pinned tasks from
+  // here on get them cancelled.
+  this->StopTimers();
+  this->DropPinned();
+  mWakeEpoch.fetch_add(1);
+  mWakeEpoch.notify_all();
 
   for (auto &worker : mWorkers) {
     if (worker.joinable()) {
       worker.join();
     }
   }
+
+  // A worker may have posted a pinned task just before it saw mStop.
+  this->DropPinned();
+  while (this->TryRunOne()) {
+  }
 }
 
-Vec<ExceptionPtr> Executor::GetExceptions() const {
-  Vec<ExceptionPtr> exceptions;
-  for (auto &handle : mHandles) {
-    if (handle.valid()) {
-      try {
-        handle.get();
-      } catch (std::exception const &e) {
-        exceptions.push_back(std::current_exception());
+void Executor::WaitForAll() {
+  // Workers notify when the count reaches zero.
+  this->WaitUntil(mNumJobs, 0u);
+}
+
+Executor::ReplayCache *Executor::GetReplayCache() {
+  Ulong generation = mReplayGeneration.load(std::memory_order_acquire);
+  if (sReplayCache.generation == generation) {
+    return &sReplayCache;
+  }
+
+  LockGuard<Mutex> lock(mReplayMutex);
+  if (mReplayMode.load() != ReplayMode::Record) {
+    return nullptr;
+  }
+  ReplayBuffer *buffer = nullptr;
+  std::thread::id self = std::this_thread::get_id();
+  for (auto &candidate : mReplayBuffers) {
+    if (candidate->owner == self) {
+      buffer = candidate.get();
+      break;
+    }
+  }
+  if (buffer == nullptr) {
+    mReplayBuffers.emplace_back(new ReplayBuffer());
+    buffer = mReplayBuffers.back().get();
+    buffer->owner = self;
+  }
+  sReplayCache.generation = mReplayGeneration.load();
+  sReplayCache.buffer = buffer;
+  sReplayCache.labels.clear();
+  return &sReplayCache;
+}
+
+void Executor::AssignRecordKey(TaskBlock *block) {
+  ReplayCache *cache = this->GetReplayCache();
+  if (cache == nullptr) {
+    return;
+  }
+
+  char const *label = block->GetOptions().label;
+  Uint id = 0u;
+  auto cached = cache->labels.find(label);
+  if (cached != cache->labels.end()) {
+    id = cached->second;
+  } else {
+    {
+      LockGuard<Mutex> lock(mReplayMutex);
+      auto named = mReplayLabelIds.find(Str(label));
+      if (named != mReplayLabelIds.end()) {
+        id = named->second;
+      } else {
+        id = static_cast<Uint>(mReplayLog.labels.size());
+        mReplayLog.labels.emplace_back(label);
+        mReplayLabelIds.emplace(label, id);
       }
     }
+    cache->labels.emplace(label, id);
   }
-  return exceptions;
+
+  if (id >= sMaxReplayLabels) {
+    return;
+  }
+  Uint occurrence =
+      mReplayOccurrences[id].fetch_add(1, std::memory_order_relaxed);
+  block->SetReplayKey((static_cast<Ulong>(id) + 1u) << 32 | occurrence);
 }
 
-Handle Executor::Schedule(Runnable const &target) {
-  Task wrapper([target]() {
-    try {
-      target();
-    } catch (std::exception const &e) {
-      Str msg = "Task failed with an exception '" + Str(e.what()) + "'.";
-      throw Exceptions::ExecutorError(msg);
+Bool Executor::AssignReplayKey(TaskBlock *block) {
+  char const *label = block->GetOptions().label;
+  Uint id = 0u;
+  auto cached = mReplayLabelCache.find(label);
+  if (cached != mReplayLabelCache.end()) {
+    id = cached->second;
+  } else {
+    auto named = mReplayLabelIds.find(Str(label));
+    if (named == mReplayLabelIds.end()) {
+      // Not in the log, so not replayed.
+      return false;
     }
-  });
-  Handle future = wrapper.get_future().share();
-  mHandles.push_back(future);
+    id = named->second;
+    mReplayLabelCache.emplace(label, id);
+  }
 
-  {
-    LockGuard<Mutex> lock(mQueueMutex);
-    mTaskQueue.push(std::move(wrapper));
-    mNumJobs.fetch_add(1);
-    mComplete.store(false);
+  if (id >= sMaxReplayLabels) {
+    return false;
+  }
+  Uint occurrence =
+      mReplayOccurrences[id].fetch_add(1, std::memory_order_relaxed);
+  block->SetReplayKey((static_cast<Ulong>(id) + 1u) << 32 | occurrence);
+  return true;
+}
+
+Bool Executor::HoldForReplay(TaskBlock *block) {
+  if (mReplayMode.load() == ReplayMode::Record) {
+    this->AssignRecordKey(block);
+    return false;
   }
-  mCV.notify_one();
 
-  return future;
+  LockGuard<Mutex> lock(mReplayMutex);
+  if (mReplayMode.load() != ReplayMode::Replay ||
+      !this->AssignReplayKey(block)) {
+    return false;
+  }
+  if (mReplayExpected.find(block->GetReplayKey()) == mReplayExpected.end()) {
+    return false;
+  }
+  mReplayHeld.emplace(block->GetReplayKey(), block);
+  this->DispatchReplay();
+  return true;
 }
 
-Handle Executor::Schedule(Runnable const &target,
-                          Vec<Handle> const &dependencies) {
-  auto wrapper = ([target, dependencies]() {
-    for (auto const &dependency : dependencies) {
-      if (dependency.valid()) {
-        dependency.wait();
+void Executor::DispatchReplay() {
+  if (mReplayRunning != nullptr) {
+    return;
+  }
+  if (mReplayCursor >= mReplayLog.entries.size()) {
+    mReplayMode.store(ReplayMode::Off);
+    return;
+  }
+
+  ReplayEntry const &entry = mReplayLog.entries[mReplayCursor];
+  Ulong key = (static_cast<Ulong>(entry.label) + 1u) << 32 | entry.occurrence;
+  auto held = mReplayHeld.find(key);
+  if (held == mReplayHeld.end()) {
+    return;
+  }
+
+  TaskBlock *block = held->second;
+  mReplayHeld.erase(held);
+  mReplayExpected.erase(key);
+  mReplayRunning = block;
+  mReplayWorker.store(entry.worker < mWorkers.size() ? entry.worker
+                                                     : ReplayEntry::sNoWorker,
+                      std::memory_order_relaxed);
+  mReplayReady.store(block, std::memory_order_release);
+  // Only the logged worker may take it, so every sleeper has to look.
+  mWakeEpoch.fetch_add(1);
+  mWakeEpoch.notify_all();
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  this->WakeWaiters();
+}
+
+void Executor::RecordReplay(TaskBlock *block) {
+  ReplayEntry entry;
+  entry.label = static_cast<Uint>((block->GetReplayKey() >> 32) - 1u);
+  entry.occurrence = static_cast<Uint>(block->GetReplayKey());
+  entry.worker = sCurrentExecutor == this ? sWorkerIndex
+                                          : ReplayEntry::sNoWorker;
+  ReplayCache *cache = this->GetReplayCache();
+  if (cache == nullptr) {
+    return;
+  }
+  ReplayRecord record;
+  record.sequence = mReplaySequence.fetch_add(1, std::memory_order_relaxed);
+  record.generation = cache->generation;
+  record.entry = entry;
+  LockGuard<Mutex> lock(cache->buffer->mutex);
+  cache->buffer->records.push_back(record);
+}
+
+Bool Executor::IsReplayStalled() const {
+  // Every outstanding job is held back and none is on its way to a worker,
+  // so the entry at the cursor can no longer become runnable.
+  return mReplayMode.load() == ReplayMode::Replay &&
+         mReplayRunning == nullptr && !mReplayHeld.empty() &&
+         mNumJobs.load() == mReplayHeld.size();
+}
+
+Bool Executor::ResolveReplayStall() {
+  // A stall only counts once it has lasted, since the missing task may be
+  // about to be scheduled from outside the executor.
+  SteadyTimePoint giveUp = SteadyClock::now() + sReplayStallTimeout;
+  Vec<TaskBlock *> held;
+  Str msg;
+  while (true) {
+    {
+      LockGuard<Mutex> lock(mReplayMutex);
+      if (!this->IsReplayStalled()) {
+        return false;
+      }
+      if (SteadyClock::now() >= giveUp) {
+        ReplayEntry const &entry = mReplayLog.entries[mReplayCursor];
+        msg = "Replay diverged from the log at entry " +
+              ToStr(mReplayCursor) + " ('" +
+              mReplayLog.labels[entry.label] + "').";
+        mReplayMode.store(ReplayMode::Off);
+        for (auto const &pending : mReplayHeld) {
+          held.push_back(pending.second);
+        }
+        mReplayHeld.clear();
+        mReplayExpected.clear();
+        break;
       }
     }
-    target();
-  });
-  return this->Schedule(wrapper);
+    std::this_thread::sleep_for(MilliSec(1));
+  }
+
+  ExceptionPtr error =
+      std::make_exception_ptr(Exceptions::ExecutorError(msg));
+  for (TaskBlock *block : held) {
+    block->Abort(error);
+    this->Execute(block);
+  }
+  return true;
+}
+
+void Executor::FinishReplay(TaskBlock *block) {
+  LockGuard<Mutex> lock(mReplayMutex);
+  if (mReplayRunning != block) {
+    return;
+  }
+  mReplayRunning = nullptr;
+  ++mReplayCursor;
+  this->DispatchReplay();
+}
+
+Bool Executor::TryPopReplay(TaskBlock *&block) {
+  TaskBlock *ready = mReplayReady.load(std::memory_order_acquire);
+  if (ready == nullptr) {
+    return false;
+  }
+  Uint worker = mReplayWorker.load(std::memory_order_relaxed);
+  if (worker != ReplayEntry::sNoWorker &&
+      (sCurrentExecutor != this || sWorkerIndex != worker)) {
+    return false;
+  }
+  if (!mReplayReady.compare_exchange_strong(ready, nullptr,
+                                            std::memory_order_acquire)) {
+    return false;
+  }
+  block = ready;
+  return true;
+}
+
+Bool Executor::HasReplayWork() const {
+  if (mReplayReady.load() == nullptr) {
+    return false;
+  }
+  Uint worker = mReplayWorker.load(std::memory_order_relaxed);
+  return worker == ReplayEntry::sNoWorker ||
+         (sCurrentExecutor == this && sWorkerIndex == worker);
+}
+
+void Executor::StartRecording() {
+  LockGuard<Mutex> lock(mReplayMutex);
+  if (mReplayMode.load() == ReplayMode::Replay) {
+    throw Exceptions::ExecutorError("Cannot record while replaying.");
+  }
+  mReplayLog = ReplayLog();
+  mReplayLabelIds.clear();
+  mReplayLabelCache.clear();
+  for (auto &occurrences : mReplayOccurrences) {
+    occurrences.store(0u, std::memory_order_relaxed);
+  }
+  for (auto &buffer : mReplayBuffers) {
+    LockGuard<Mutex> bufferLock(buffer->mutex);
+    buffer->records.clear();
+  }
+  mReplaySequence.store(0u);
+  // Generations are unique across executors, so a thread's cache from
+  // another executor or an earlier recording is never mistaken for this one.
+  mReplayGeneration.store(sNumReplayGenerations.fetch_add(1) + 1,
+                          std::memory_order_release);
+  mReplayMode.store(ReplayMode::Record);
+}
+
+ReplayLog Executor::StopRecording() {
+  LockGuard<Mutex> lock(mReplayMutex);
+  Bool recording = mReplayMode.load() == ReplayMode::Record;
+  if (recording) {
+    mReplayMode.store(ReplayMode::Off);
+  }
+  ReplayLog log = std::move(mReplayLog);
+  mReplayLog = ReplayLog();
+  if (!recording) {
+    return log;
+  }
+
+  Ulong generation = mReplayGeneration.load();
+  Vec<ReplayRecord> records;
+  for (auto &buffer : mReplayBuffers) {
+    LockGuard<Mutex> bufferLock(buffer->mutex);
+    for (auto const &record : buffer->records) {
+      if (record.generation == generation) {
+        records.push_back(record);
+      }
+    }
+    buffer->records.clear();
+  }
+  std::sort(records.begin(), records.end(),
+            [](ReplayRecord const &lhs, ReplayRecord const &rhs) {
+              return lhs.sequence < rhs.sequence;
+            });
+  log.entries.reserve(records.size());
+  for (auto const &record : records) {
+    log.entries.push_back(record.entry);
+  }
+  return log;
+}
+
+void Executor::StartReplay(ReplayLog const &log) {
+  LockGuard<Mutex> lock(mReplayMutex);
+  if (mReplayMode.load() != ReplayMode::Off) {
+    throw Exceptions::ExecutorError("Executor is already recording or "
+                                    "replaying.");
+  }
+  mReplayLog = log;
+  mReplayLabelIds.clear();
+  mReplayLabelCache.clear();
+  for (auto &occurrences : mReplayOccurrences) {
+    occurrences.store(0u, std::memory_order_relaxed);
+  }
+  for (Uint id = 0; id < mReplayLog.labels.size(); ++id) {
+    mReplayLabelIds.emplace(mReplayLog.labels[id], id);
+  }
+  mReplayExpected.clear();
+  for (auto const &entry : mReplayLog.entries) {
+    mReplayExpected.insert((static_cast<Ulong>(entry.label) + 1u) << 32 |
+                           entry.occurrence);
+  }
+  mReplayCursor = 0u;
+  mReplayRunning = nullptr;
+  mReplayMode.store(mReplayLog.entries.empty() ? ReplayMode::Off
+                                               : ReplayMode::Replay);
+}
+
+void Executor::StopReplay() {
+  Vec<TaskBlock *> held;
+  {
+    LockGuard<Mutex> lock(mReplayMutex);
+    if (mReplayMode.load() == ReplayMode::Replay) {
+      mReplayMode.store(ReplayMode::Off);
+    }
+    for (auto const &entry : mReplayHeld) {
+      held.push_back(entry.second);
+    }
+    mReplayHeld.clear();
+    mReplayExpected.clear();
+  }
+  for (TaskBlock *block : held) {
+    this->Enqueue(block);
+  }
+}
+
+Size Executor::GetReplayPosition() {
+  LockGuard<Mutex> lock(mReplayMutex);
+  return mReplayCursor;
+}
+
+ScratchArena &Executor::CurrentArena() {
+  if (sArena) {
+    return *sArena;
+  }
+  thread_local ScratchArena arena;
+  return arena;
+}
+
+void Executor::ResetArenas() {
+  for (auto &arena : mArenas) {
+    arena->Reset();
+  }
+  if (sCurrentExecutor != this) {
+    CurrentArena().Reset();
+  }
+}
+
+ID Executor::GetPinnedQueue(Str const &name) const {
+  for (ID id = 0; id < mPinnedQueues.size(); ++id) {
+    if (mPinnedQueues[id]->name == name) {
+      return id;
+    }
+  }
+  throw Exceptions::ExecutorError("Pinned queue '" + name +
+                                  "' does not exist.");
+}
+
+Size Executor::PumpPinned(ID const &queue, NanoSec const &budget) {
+  if (queue >= mPinnedQueues.size()) {
+    throw Exceptions::ExecutorError("Pinned queue does not exist.");
+  }
+
+  PinnedQueue &pinned = *mPinnedQueues[queue];
+  std::thread::id self = std::this_thread::get_id();
+  std::thread::id owner = std::thread::id();
+  if (!pinned.owner.compare_exchange_strong(owner, self) && owner != self) {
+    throw Exceptions::ExecutorError("Pinned queue '" + pinned.name +
+                                    "' is pumped by another thread.");
+  }
+
+  SteadyTimePoint end = budget == NanoSec::max()
+                            ? SteadyTimePoint::max()
+                            : Now() + DurationCast<SteadyClock::duration>(budget);
+  Size numRun = 0u;
+  while (end == SteadyTimePoint::max() || Now() < end) {
+    TaskBlock *block = this->PopPinned(pinned);
+    if (block == nullptr) {
+      break;
+    }
+    this->RunBlock(block);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    this->WakeWaiters();
+    ++numRun;
+  }
+  return numRun;
+}
+
+Bool Executor::CancelTimer(HandleBase const &handle) {
+  TaskBlock *block = handle.mBlock;
+  if (block == nullptr || block->GetExecutor() != this) {
+    return false;
+  }
+  {
+    LockGuard<Mutex> lock(mTimerMutex);
+    if (!mTimers.Remove(block)) {
+      return false;
+    }
+  }
+  block->Cancel();
+  this->Execute(block);
+  return true;
+}
+
+void Executor::Wait(HandleBase const &handle) {
+  if (!handle.Valid()) {
+    return;
+  }
+  while (!handle.Done()) {
+    if (!this->TryRunOne() &&
+        (mReplayMode.load(std::memory_order_relaxed) != ReplayMode::Replay ||
+         !this->ResolveReplayStall())) {
+      this->ParkWaiter([&handle]() { return handle.Done(); });
+    }
+  }
+}
+
+LaneMetrics Executor::GetLaneMetrics(TaskPriority const &priority) const {
+  LaneCounters const &counters = mLaneCounters[static_cast<Uint>(priority)];
+  LaneMetrics metrics;
+  metrics.numTasks = counters.numTasks.load();
+  metrics.totalWait = NanoSec(counters.totalWait.load());
+  metrics.maxWait = NanoSec(counters.maxWait.load());
+  metrics.numMissedDeadlines = counters.numMissedDeadlines.load();
+  return metrics;
+}
+
+IdleMetrics Executor::GetIdleMetrics() const {
+  IdleMetrics metrics;
+  metrics.numSpins = mIdleCounters.numSpins.load();
+  metrics.numSpinHits = mIdleCounters.numSpinHits.load();
+  metrics.numParks = mIdleCounters.numParks.load();
+  metrics.numWakeups = mIdleCounters.numWakeups.load();
+  metrics.spinTime = NanoSec(mIdleCounters.spinTime.load());
+  return metrics;
+}
+
+void Executor::ResetMetrics() {
+  for (auto &counters : mLaneCounters) {
+    counters.numTasks.store(0u);
+    counters.totalWait.store(0);
+    counters.maxWait.store(0);
+    counters.numMissedDeadlines.store(0u);
+  }
+  mIdleCounters.numSpins.store(0u);
+  mIdleCounters.numSpinHits.store(0u);
+  mIdleCounters.numParks.store(0u);
+  mIdleCounters.numWakeups.store(0u);
+  mIdleCounters.spinTime.store(0);
+}
+
+Vec<ExceptionPtr> Executor::GetExceptions() {
+  Vec<ExceptionPtr> exceptions;
+  ExceptionPtr error;
+  while (mErrors.TryPop(error)) {
+    exceptions.push_back(std::move(error));
+  }
+  return exceptions;
 }
 } // namespace TerreateCore::Utils
@@ -0,0 +1,131 @@
+#include "../includes/replay.hpp"
+#include "../includes/exceptions.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+namespace {
+Ubyte const sMagic[4] = {'T', 'C', 'R', 'L'};
+Ubyte const sVersion = 2u;
+
+void WriteVarint(Vec<Ubyte> &out, Ulong value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<Ubyte>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<Ubyte>(value));
+}
+
+Ulong ReadVarint(Vec<Ubyte> const &data, Size &offset) {
+  Ulong value = 0u;
+  for (Uint shift = 0; shift < 64; shift += 7) {
+    if (offset >= data.size()) {
+      throw Exceptions::ExecutorError("Replay log is truncated.");
+    }
+    Ubyte byte = data[offset++];
+    value |= static_cast<Ulong>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  throw Exceptions::ExecutorError("Replay log has a malformed number.");
+}
+} // namespace
+
+Vec<Ubyte> ReplayLog::Encode() const {
+  Vec<Ubyte> data(std::begin(sMagic), std::end(sMagic));
+  data.push_back(sVersion);
+
+  WriteVarint(data, labels.size());
+  for (auto const &label : labels) {
+    WriteVarint(data, label.size());
+    data.insert(data.end(), label.begin(), label.end());
+  }
+
+  // Occurrences are stored as the zigzag-encoded distance from the one after
+  // the label's previous entry. Tasks of a label mostly start in the order
+  // they were queued, so that is 0 and takes one byte however long the run.
+  Vec<Long> next(labels.size(), 0);
+  WriteVarint(data, entries.size());
+  for (auto const &entry : entries) {
+    Long delta = static_cast<Long>(entry.occurrence) - next[entry.label];
+    next[entry.label] = static_cast<Long>(entry.occurrence) + 1;
+    WriteVarint(data, entry.label);
+    WriteVarint(data, static_cast<Ulong>(delta << 1) ^
+                          static_cast<Ulong>(delta >> 63));
+    // Waiting threads are stored as 0 so worker ids stay one byte.
+    WriteVarint(data, entry.worker == ReplayEntry::sNoWorker
+                          ? 0u
+                          : static_cast<Ulong>(entry.worker) + 1u);
+  }
+  return data;
+}
+
+ReplayLog ReplayLog::Decode(Vec<Ubyte> const &data) {
+  if (data.size() < 5 || !std::equal(std::begin(sMagic), std::end(sMagic),
+                                     data.begin())) {
+    throw Exceptions::ExecutorError("Data is not a replay log.");
+  }
+  if (data[4] != sVersion) {
+    throw Exceptions::ExecutorError("Unsupported replay log version.");
+  }
+
+  ReplayLog log;
+  Size offset = 5u;
+  Ulong numLabels = ReadVarint(data, offset);
+  for (Ulong i = 0; i < numLabels; ++i) {
+    Ulong length = ReadVarint(data, offset);
+    if (length > data.size() - offset) {
+      throw Exceptions::ExecutorError("Replay log is truncated.");
+    }
+    log.labels.emplace_back(data.begin() + offset,
+                            data.begin() + offset + length);
+    offset += length;
+  }
+
+  Vec<Long> next(log.labels.size(), 0);
+  Ulong numEntries = ReadVarint(data, offset);
+  for (Ulong i = 0; i < numEntries; ++i) {
+    ReplayEntry entry;
+    entry.label = static_cast<Uint>(ReadVarint(data, offset));
+    if (entry.label >= log.labels.size()) {
+      throw Exceptions::ExecutorError("Replay log refers to a missing label.");
+    }
+    Ulong zigzag = ReadVarint(data, offset);
+    Long delta = static_cast<Long>(zigzag >> 1) ^ -static_cast<Long>(zigzag & 1);
+    entry.occurrence = static_cast<Uint>(next[entry.label] + delta);
+    next[entry.label] = static_cast<Long>(entry.occurrence) + 1;
+    Ulong worker = ReadVarint(data, offset);
+    entry.worker = worker == 0u ? ReplayEntry::sNoWorker
+                                : static_cast<Uint>(worker - 1u);
+    log.entries.push_back(entry);
+  }
+  return log;
+}
+
+Bool ReplayLog::Save(Str const &path) const {
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  Vec<Ubyte> data = this->Encode();
+  file.write(reinterpret_cast<char const *>(data.data()),
+             static_cast<std::streamsize>(data.size()));
+  return static_cast<Bool>(file);
+}
+
+ReplayLog ReplayLog::Load(Str const &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw Exceptions::ExecutorError("Failed to open replay log '" + path +
+                                    "'.");
+  }
+  Vec<Ubyte> data((std::istreambuf_iterator<char>(file)),
+                  std::istreambuf_iterator<char>());
+  return Decode(data);
+}
+} // namespace TerreateCore::Utils
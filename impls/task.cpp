@@ -0,0 +1,291 @@
+#include "../includes/task.hpp"
+#include "../includes/exceptions.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+/*
+ * @brief: Recycles task blocks. Every thread keeps a small free list and
+ * exchanges blocks with the shared list in batches, so the shared mutex is
+ * taken once per batch rather than once per task.
+ */
+class TaskBlockPool {
+private:
+  static constexpr Uint sBatchSize = 64;
+
+  struct LocalCache {
+    TaskBlock *head = nullptr;
+    Uint count = 0u;
+
+    ~LocalCache();
+  };
+
+private:
+  static thread_local LocalCache sCache;
+
+private:
+  Mutex mMutex;
+  TaskBlock *mFree = nullptr;
+  Vec<UniquePtr<TaskBlock[]>> mSlabs;
+  Atomic<Size> mNumAllocated = 0u;
+
+public:
+  // The pool is never destroyed so that blocks released during static
+  // destruction still have somewhere to go.
+  static TaskBlockPool &Instance() {
+    static TaskBlockPool *instance = new TaskBlockPool();
+    return *instance;
+  }
+
+  Size GetNumAllocated() const { return mNumAllocated.load(); }
+
+  TaskBlock *Acquire();
+  void Release(TaskBlock *block);
+  void Refill(LocalCache &cache);
+  void Drain(LocalCache &cache, Uint const &count);
+};
+
+thread_local TaskBlockPool::LocalCache TaskBlockPool::sCache;
+
+TaskBlockPool::LocalCache::~LocalCache() {
+  if (count > 0) {
+    TaskBlockPool::Instance().Drain(*this, count);
+  }
+}
+
+TaskBlock *TaskBlockPool::Acquire() {
+  if (sCache.head == nullptr) {
+    this->Refill(sCache);
+  }
+  TaskBlock *block = sCache.head;
+  sCache.head = block->mNext;
+  --sCache.count;
+  block->mNext = nullptr;
+  return block;
+}
+
+void TaskBlockPool::Release(TaskBlock *block) {
+  block->mNext = sCache.head;
+  sCache.head = block;
+  if (++sCache.count >= sBatchSize * 2) {
+    this->Drain(sCache, sBatchSize);
+  }
+}
+
+void TaskBlockPool::Refill(LocalCache &cache) {
+  LockGuard<Mutex> lock(mMutex);
+  if (mFree == nullptr) {
+    TaskBlock *slab = new TaskBlock[sBatchSize];
+    mSlabs.emplace_back(slab);
+    mNumAllocated.fetch_add(sBatchSize);
+    for (Uint i = 0; i < sBatchSize; ++i) {
+      slab[i].mNext = mFree;
+      mFree = &slab[i];
+    }
+  }
+
+  for (Uint i = 0; i < sBatchSize && mFree != nullptr; ++i) {
+    TaskBlock *block = mFree;
+    mFree = block->mNext;
+    block->mNext = cache.head;
+    cache.head = block;
+    ++cache.count;
+  }
+}
+
+void TaskBlockPool::Drain(LocalCache &cache, Uint const &count) {
+  LockGuard<Mutex> lock(mMutex);
+  for (Uint i = 0; i < count && cache.head != nullptr; ++i) {
+    TaskBlock *block = cache.head;
+    cache.head = block->mNext;
+    --cache.count;
+    block->mNext = mFree;
+    mFree = block;
+  }
+}
+
+TaskBlock *TaskBlock::Acquire() {
+  TaskBlock *block = TaskBlockPool::Instance().Acquire();
+  block->mRefCount.store(1u, std::memory_order_relaxed);
+  block->mState.store(State::Pending, std::memory_order_relaxed);
+  block->mPendingDependencies.store(0u, std::memory_order_relaxed);
+  block->mExecutor = nullptr;
+  block->mQueuedAt = SteadyTimePoint();
+  block->mTracedAt = 0u;
+  block->mReplayKey = 0u;
+  return block;
+}
+
+Size TaskBlock::GetNumAllocated() {
+  return TaskBlockPool::Instance().GetNumAllocated();
+}
+
+Bool TaskBlock::Run() {
+  State pending = State::Pending;
+  if (!mState.compare_exchange_strong(pending, State::Running,
+                                      std::memory_order_acq_rel)) {
+    // Cancelled. Let the canceller finish so the successor list is closed
+    // before the caller releases it.
+    this->Wait();
+    return false;
+  }
+
+  try {
+    mInvoke(this);
+  } catch (std::exception const &e) {
+    Str msg = "Task failed with an exception '" + Str(e.what()) + "'.";
+    mException = std::make_exception_ptr(Exceptions::ExecutorError(msg));
+  } catch (...) {
+    mException = std::current_exception();
+  }
+  if (mCallable) {
+    mDestroy(mCallable);
+    mCallable = nullptr;
+  }
+  this->Finish(State::Done);
+  return true;
+}
+
+Bool TaskBlock::Cancel() {
+  return this->Abort(std::make_exception_ptr(
+      Exceptions::TaskCancelled("Task was cancelled.")));
+}
+
+Bool TaskBlock::Abort(ExceptionPtr const &error) {
+  State pending = State::Pending;
+  if (!mState.compare_exchange_strong(pending, State::Running,
+                                      std::memory_order_acq_rel)) {
+    return false;
+  }
+
+  // The block itself stays queued until a worker pops and skips it, but
+  // whatever the callable holds is released now.
+  mDestroy(mCallable);
+  mCallable = nullptr;
+  mException = error;
+  this->Finish(State::Cancelled);
+  return true;
+}
+
+void TaskBlock::Finish(State const &state) {
+  // Publishing the state under the successor lock closes the list.
+  this->LockSuccessors();
+  mState.store(state, std::memory_order_release);
+  this->UnlockSuccessors();
+  mState.notify_all();
+}
+
+void TaskBlock::AttachToken() {
+  CancellationState *state = mOptions.token.mState.get();
+  if (state == nullptr) {
+    return;
+  }
+
+  {
+    LockGuard<Mutex> lock(state->mutex);
+    if (!state->cancelled.load(std::memory_order_relaxed)) {
+      // The list keeps its own reference so Cancel() can still reach the
+      // block after the executor let go of it.
+      this->AddRef();
+      mTokenPrev = nullptr;
+      mTokenNext = state->head;
+      if (state->head) {
+        state->head->mTokenPrev = this;
+      }
+      state->head = this;
+      mTokenLinked = true;
+      return;
+    }
+  }
+  this->Cancel();
+}
+
+void TaskBlock::UnlinkToken() {
+  CancellationState *state = mOptions.token.mState.get();
+  if (mTokenPrev) {
+    mTokenPrev->mTokenNext = mTokenNext;
+  } else {
+    state->head = mTokenNext;
+  }
+  if (mTokenNext) {
+    mTokenNext->mTokenPrev = mTokenPrev;
+  }
+  mTokenPrev = nullptr;
+  mTokenNext = nullptr;
+  mTokenLinked = false;
+}
+
+void TaskBlock::DetachToken() {
+  CancellationState *state = mOptions.token.mState.get();
+  if (state == nullptr) {
+    return;
+  }
+
+  Bool linked = false;
+  {
+    LockGuard<Mutex> lock(state->mutex);
+    linked = mTokenLinked;
+    if (linked) {
+      this->UnlinkToken();
+    }
+  }
+  if (linked) {
+    this->Release();
+  }
+}
+
+void CancellationToken::ThrowIfCancelled() const {
+  if (this->IsCancelled()) {
+    throw Exceptions::TaskCancelled("Task was cancelled.");
+  }
+}
+
+Size CancellationSource::Cancel() {
+  Vec<TaskBlock *> blocks;
+  {
+    LockGuard<Mutex> lock(mState->mutex);
+    mState->cancelled.store(true, std::memory_order_release);
+    while (mState->head) {
+      blocks.push_back(mState->head);
+      mState->head->UnlinkToken();
+    }
+  }
+
+  // Callables are destroyed outside the lock in case their destructors
+  // schedule or cancel more work.
+  Size numDropped = 0u;
+  for (TaskBlock *block : blocks) {
+    if (block->Cancel()) {
+      ++numDropped;
+    }
+    block->Release();
+  }
+  return numDropped;
+}
+
+Bool TaskBlock::AddSuccessor(TaskBlock *successor) {
+  this->LockSuccessors();
+  if (this->Done()) {
+    this->UnlockSuccessors();
+    return false;
+  }
+  successor->AddDependency();
+  mSuccessors.push_back(successor);
+  this->UnlockSuccessors();
+  return true;
+}
+
+void TaskBlock::Recycle() {
+  if (mCallable) {
+    mDestroy(mCallable);
+    mCallable = nullptr;
+  }
+  if (mResult) {
+    mDestroyResult(mResult);
+    mResult = nullptr;
+  }
+  mException = nullptr;
+  mOptions = TaskOptions();
+  TaskBlockPool::Instance().Release(this);
+}
+} // namespace TerreateCore::Utils
@@ -0,0 +1,54 @@
+#include "../includes/taskgroup.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+TaskGroup::TaskGroup(Executor &executor, TaskOptions const &options)
+    : mExecutor(executor), mOptions(options) {
+  mOptions.token = mSource.GetToken();
+}
+
+TaskGroup::~TaskGroup() {
+  if (!mWaited || mNumPending.load() != 0) {
+    // Nobody is going to look at the results any more.
+    mSource.Cancel();
+  }
+  // Even with nothing pending, the task that closed the last round may
+  // still be inside Finish().
+  this->WaitSettled();
+}
+
+void TaskGroup::Finish() {
+  if (mNumPending.fetch_sub(1) == 1) {
+    mNumPending.notify_all();
+    mNumSettledRounds.fetch_add(1, std::memory_order_release);
+  }
+}
+
+void TaskGroup::WaitSettled() {
+  mExecutor.WaitUntil(mNumPending, Size(0u));
+  // Only the last task's notify can still be in flight here.
+  while (mNumSettledRounds.load(std::memory_order_acquire) !=
+         mNumRounds.load(std::memory_order_relaxed)) {
+    std::this_thread::yield();
+  }
+}
+
+void TaskGroup::Fail(ExceptionPtr const &error) {
+  if (!mFailed.exchange(true)) {
+    mError = error;
+    mSource.Cancel();
+  }
+}
+
+void TaskGroup::Wait() {
+  this->WaitSettled();
+  mWaited = true;
+  // The last Finish() happens after every Fail(), so the error is visible.
+  if (mError) {
+    ExceptionPtr error = mError;
+    mError = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+} // namespace TerreateCore::Utils
@@ -0,0 +1,85 @@
+#include "../includes/thread.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+namespace {
+// Parse a kernel cpulist such as "0-3,8-11".
+Vec<Uint> ParseCpuList(Str const &list) {
+  Vec<Uint> cpus;
+  Stream stream(list);
+  Str range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    Size dash = range.find('-');
+    Uint first = static_cast<Uint>(std::stoul(range.substr(0, dash)));
+    Uint last = dash == Str::npos
+                    ? first
+                    : static_cast<Uint>(std::stoul(range.substr(dash + 1)));
+    for (Uint cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+} // namespace
+
+Vec<Vec<Uint>> GetNumaNodes() {
+  Vec<Vec<Uint>> nodes;
+#ifdef __linux__
+  // Node ids can have gaps, so probe a generous range.
+  for (Uint node = 0; node < 1024; ++node) {
+    InputFileStream file("/sys/devices/system/node/node" + ToStr(node) +
+                         "/cpulist");
+    if (!file.is_open()) {
+      continue;
+    }
+    Str list;
+    std::getline(file, list);
+    Vec<Uint> cpus = ParseCpuList(list);
+    if (!cpus.empty()) {
+      nodes.push_back(std::move(cpus));
+    }
+  }
+#endif
+
+  if (nodes.empty()) {
+    Vec<Uint> cpus(std::max(1u, std::thread::hardware_concurrency()));
+    for (Uint cpu = 0; cpu < cpus.size(); ++cpu) {
+      cpus[cpu] = cpu;
+    }
+    nodes.push_back(std::move(cpus));
+  }
+  return nodes;
+}
+
+Bool SetThreadAffinity(Vec<Uint> const &cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (Uint cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+Bool SetThreadName(Str const &name) {
+#ifdef __linux__
+  return pthread_setname_np(pthread_self(), name.substr(0, 15).c_str()) == 0;
+#else
+  return false;
+#endif
+}
+} // namespace TerreateCore::Utils
@@ -0,0 +1,182 @@
+#include "../includes/timer.hpp"
+
+#include <bit>
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+TimerWheel::TimerWheel(NanoSec const &resolution)
+    : mResolution(resolution), mOrigin(Now()) {}
+
+Ulong TimerWheel::ToTick(SteadyTimePoint const &time,
+                         Bool const &roundUp) const {
+  if (time <= mOrigin) {
+    return 0u;
+  }
+  Ulong elapsed = static_cast<Ulong>(
+      DurationCast<NanoSec>(time - mOrigin).count());
+  Ulong resolution = static_cast<Ulong>(mResolution.count());
+  Ulong tick = elapsed / resolution;
+  if (roundUp && elapsed % resolution != 0) {
+    ++tick;
+  }
+  return tick;
+}
+
+void TimerWheel::Link(TaskBlock *block, Uint const &level, Uint const &slot) {
+  TaskBlock *&head = mSlots[level][slot];
+  block->mTimerPrev = nullptr;
+  block->mTimerNext = head;
+  if (head) {
+    head->mTimerPrev = block;
+  }
+  head = block;
+  block->mTimerSlot = &head;
+  mOccupied[level] |= 1ull << slot;
+}
+
+void TimerWheel::Unlink(TaskBlock *block) {
+  if (block->mTimerPrev) {
+    block->mTimerPrev->mTimerNext = block->mTimerNext;
+  } else {
+    *block->mTimerSlot = block->mTimerNext;
+  }
+  if (block->mTimerNext) {
+    block->mTimerNext->mTimerPrev = block->mTimerPrev;
+  }
+
+  if (*block->mTimerSlot == nullptr) {
+    Size index = static_cast<Size>(block->mTimerSlot - &mSlots[0][0]);
+    mOccupied[index / sNumSlots] &= ~(1ull << (index % sNumSlots));
+  }
+  block->mTimerPrev = nullptr;
+  block->mTimerNext = nullptr;
+  block->mTimerSlot = nullptr;
+}
+
+void TimerWheel::Place(TaskBlock *block) {
+  Ulong tick = block->mTimerTick;
+  Ulong delta = tick > mCurrent ? tick - mCurrent : 0u;
+  if (delta >= sRange) {
+    // Out of range: park it in the farthest slot and re-place it from there.
+    tick = mCurrent + sRange - 1u;
+    delta = sRange - 1u;
+  }
+
+  Uint level = 0u;
+  while (level + 1u < sNumLevels &&
+         delta >= (1ull << (sSlotBits * (level + 1u)))) {
+    ++level;
+  }
+  this->Link(block, level,
+             static_cast<Uint>((tick >> (sSlotBits * level)) & sSlotMask));
+}
+
+TaskBlock *TimerWheel::TakeSlot(Uint const &level, Uint const &slot) {
+  TaskBlock *list = mSlots[level][slot];
+  mSlots[level][slot] = nullptr;
+  mOccupied[level] &= ~(1ull << slot);
+  return list;
+}
+
+Bool TimerWheel::Insert(TaskBlock *block, SteadyTimePoint const &time) {
+  Ulong tick = this->ToTick(time, true);
+  if (tick <= mCurrent) {
+    return false;
+  }
+  block->mTimerTick = tick;
+  this->Place(block);
+  ++mCount;
+  return true;
+}
+
+Bool TimerWheel::Remove(TaskBlock *block) {
+  if (block->mTimerSlot == nullptr) {
+    return false;
+  }
+  this->Unlink(block);
+  --mCount;
+  return true;
+}
+
+void TimerWheel::Advance(SteadyTimePoint const &now,
+                         Vec<TaskBlock *> &expired) {
+  Ulong target = this->ToTick(now, false);
+  while (mCurrent < target) {
+    if (mCount == 0) {
+      mCurrent = target;
+      return;
+    }
+    ++mCurrent;
+
+    // Slots of higher levels come round when the bits below them wrap. The
+    // highest level goes first so what it hands down is handed on this tick.
+    Uint top = 0u;
+    while (top + 1u < sNumLevels &&
+           (mCurrent & ((1ull << (sSlotBits * (top + 1u))) - 1u)) == 0) {
+      ++top;
+    }
+    for (Uint level = top; level > 0; --level) {
+      Uint slot =
+          static_cast<Uint>((mCurrent >> (sSlotBits * level)) & sSlotMask);
+      TaskBlock *list = this->TakeSlot(level, slot);
+      while (list) {
+        TaskBlock *next = list->mTimerNext;
+        this->Place(list);
+        list = next;
+      }
+    }
+
+    TaskBlock *list = this->TakeSlot(0u, static_cast<Uint>(mCurrent & sSlotMask));
+    while (list) {
+      TaskBlock *next = list->mTimerNext;
+      list->mTimerPrev = nullptr;
+      list->mTimerNext = nullptr;
+      list->mTimerSlot = nullptr;
+      expired.push_back(list);
+      --mCount;
+      list = next;
+    }
+  }
+}
+
+void TimerWheel::Clear(Vec<TaskBlock *> &blocks) {
+  for (Uint level = 0; level < sNumLevels; ++level) {
+    for (Uint slot = 0; slot < sNumSlots; ++slot) {
+      TaskBlock *list = this->TakeSlot(level, slot);
+      while (list) {
+        TaskBlock *next = list->mTimerNext;
+        list->mTimerPrev = nullptr;
+        list->mTimerNext = nullptr;
+        list->mTimerSlot = nullptr;
+        blocks.push_back(list);
+        list = next;
+      }
+    }
+  }
+  mCount = 0u;
+}
+
+SteadyTimePoint TimerWheel::GetNextExpiry() const {
+  if (mCount == 0) {
+    return SteadyTimePoint::max();
+  }
+
+  // A slot is reached, or handed down, when its level's index next equals
+  // it. Nothing in it is due earlier than that.
+  Ulong next = ~0ull;
+  for (Uint level = 0; level < sNumLevels; ++level) {
+    if (mOccupied[level] == 0) {
+      continue;
+    }
+    Uint shift = sSlotBits * level;
+    Ulong position = mCurrent >> shift;
+    Uint start = static_cast<Uint>((position + 1u) & sSlotMask);
+    Ulong distance = static_cast<Ulong>(
+                         std::countr_zero(std::rotr(mOccupied[level], start))) +
+                     1u;
+    next = std::min(next, (position + distance) << shift);
+  }
+  return this->ToTime(next);
+}
+} // namespace TerreateCore::Utils
@@ -0,0 +1,211 @@
+#include "../includes/trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+thread_local TaskTracer::Buffer *TaskTracer::sBuffer = nullptr;
+
+namespace {
+void AppendEscaped(Str &out, char const *text) {
+  for (; *text; ++text) {
+    char c = *text;
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char code[8];
+      std::snprintf(code, sizeof(code), "\\u%04x", c);
+      out += code;
+    } else {
+      out.push_back(c);
+    }
+  }
+}
+
+void AppendMicros(Str &out, Long const &nanos) {
+  char number[32];
+  std::snprintf(number, sizeof(number), "%.3f", nanos / 1e3);
+  out += number;
+}
+} // namespace
+
+TaskTracer &TaskTracer::Instance() {
+  static TaskTracer *instance = new TaskTracer();
+  return *instance;
+}
+
+TaskTracer::TaskTracer()
+    : mOriginNanos(DurationCast<NanoSec>(SinceEpoch()).count()),
+      mOriginTicks(Timestamp()) {}
+
+Double TaskTracer::GetNanosPerTick() const {
+  // The ratio is measured over the tracer's lifetime, which is long enough
+  // to make it exact in practice; very early calls wait a little first.
+  Long nanos = DurationCast<NanoSec>(SinceEpoch()).count();
+  while (nanos - mOriginNanos < 1000000) {
+    std::this_thread::yield();
+    nanos = DurationCast<NanoSec>(SinceEpoch()).count();
+  }
+  Ulong ticks = Timestamp();
+  if (ticks <= mOriginTicks) {
+    return 1.0;
+  }
+  return static_cast<Double>(nanos - mOriginNanos) /
+         static_cast<Double>(ticks - mOriginTicks);
+}
+
+TaskTracer::ThreadLease::~ThreadLease() {
+  if (sBuffer) {
+    Instance().ReleaseBuffer(sBuffer);
+    sBuffer = nullptr;
+  }
+}
+
+TaskTracer::Buffer *TaskTracer::CreateBuffer() {
+  // Registers the thread-exit hook on the thread's first record.
+  thread_local ThreadLease lease;
+  (void)lease;
+
+  {
+    LockGuard<Mutex> lock(mMutex);
+    for (auto &buffer : mBuffers) {
+      if (buffer->released) {
+        buffer->released = false;
+        buffer->name = "thread-" + ToStr(buffer->index);
+        sBuffer = buffer.get();
+        return sBuffer;
+      }
+    }
+  }
+
+  UniquePtr<Buffer> buffer(new Buffer());
+  buffer->events.reset(new TraceEvent[sCapacity]);
+
+  LockGuard<Mutex> lock(mMutex);
+  buffer->index = static_cast<Uint>(mBuffers.size());
+  buffer->name = "thread-" + ToStr(buffer->index);
+  sBuffer = buffer.get();
+  mBuffers.push_back(std::move(buffer));
+  return sBuffer;
+}
+
+void TaskTracer::ReleaseBuffer(Buffer *buffer) {
+  LockGuard<Mutex> lock(mMutex);
+  buffer->released = true;
+}
+
+Size TaskTracer::GetNumBuffers() {
+  LockGuard<Mutex> lock(mMutex);
+  return mBuffers.size();
+}
+
+void TaskTracer::SetThreadName(Str const &name) {
+  Buffer *buffer = sBuffer ? sBuffer : this->CreateBuffer();
+  LockGuard<Mutex> lock(mMutex);
+  buffer->name = name;
+}
+
+Vec<TraceEvent> TaskTracer::Collect() {
+  Vec<TraceEvent> events;
+  LockGuard<Mutex> lock(mMutex);
+  for (auto &buffer : mBuffers) {
+    Size head = buffer->head.load(std::memory_order_acquire);
+    Size begin = std::max(buffer->start.load(),
+                          head > sCapacity ? head - sCapacity : 0u);
+    Size first = events.size();
+    for (Size i = begin; i < head; ++i) {
+      events.push_back(buffer->events[i & (sCapacity - 1)]);
+    }
+
+    // Drop whatever the owner may have overwritten while it was copied.
+    Size after = buffer->head.load(std::memory_order_acquire);
+    if (after > sCapacity && after - sCapacity > begin) {
+      Size numStale = std::min(after - sCapacity - begin, head - begin);
+      events.erase(events.begin() + first,
+                   events.begin() + first + numStale);
+    }
+  }
+
+  Double scale = this->GetNanosPerTick();
+  auto toNanos = [&](Long const &ticks) {
+    Long elapsed = static_cast<Long>(static_cast<Ulong>(ticks) - mOriginTicks);
+    return mOriginNanos + static_cast<Long>(elapsed * scale);
+  };
+  for (auto &event : events) {
+    event.enqueued = toNanos(event.enqueued);
+    event.started = toNanos(event.started);
+    event.finished = toNanos(event.finished);
+  }
+
+  std::sort(events.begin(), events.end(),
+            [](TraceEvent const &a, TraceEvent const &b) {
+              return a.started < b.started;
+            });
+  return events;
+}
+
+void TaskTracer::Clear() {
+  LockGuard<Mutex> lock(mMutex);
+  for (auto &buffer : mBuffers) {
+    buffer->start.store(buffer->head.load());
+  }
+}
+
+Str TaskTracer::ToChromeTrace() {
+  Vec<TraceEvent> events = this->Collect();
+  Long origin = events.empty() ? 0 : events.front().enqueued;
+  for (auto const &event : events) {
+    origin = std::min(origin, event.enqueued);
+  }
+
+  Str json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  Bool first = true;
+  {
+    LockGuard<Mutex> lock(mMutex);
+    for (auto const &buffer : mBuffers) {
+      json += first ? "\n" : ",\n";
+      first = false;
+      json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+      json += ToStr(buffer->index);
+      json += ",\"args\":{\"name\":\"";
+      AppendEscaped(json, buffer->name.c_str());
+      json += "\"}}";
+    }
+  }
+
+  for (auto const &event : events) {
+    json += first ? "\n" : ",\n";
+    first = false;
+    json += "{\"name\":\"";
+    AppendEscaped(json, event.label ? event.label : "task");
+    json += "\",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+    json += ToStr(event.thread);
+    json += ",\"ts\":";
+    AppendMicros(json, event.started - origin);
+    json += ",\"dur\":";
+    AppendMicros(json, event.finished - event.started);
+    json += ",\"args\":{\"worker\":";
+    json += event.worker == TraceEvent::sNoWorker ? Str("-1")
+                                                  : ToStr(event.worker);
+    json += ",\"queued_us\":";
+    AppendMicros(json, event.started - event.enqueued);
+    json += "}}";
+  }
+  json += "\n]}\n";
+  return json;
+}
+
+Bool TaskTracer::WriteChromeTrace(Str const &path) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  file << this->ToChromeTrace();
+  return static_cast<Bool>(file);
+}
+} // namespace TerreateCore::Utils
@@ -1,13 +1,24 @@
 #ifndef __TERREATECORE_HPP__
 #define __TERREATECORE_HPP__
 
+#include "arena.hpp"
 #include "bitflag.hpp"
+#include "coroutine.hpp"
 #include "defines.hpp"
 #include "event.hpp"
+#include "exceptions.hpp"
 #include "executor.hpp"
+#include "lockfree.hpp"
 #include "math.hpp"
 #include "nullable.hpp"
 #include "object.hpp"
+#include "parallel.hpp"
+#include "replay.hpp"
+#include "task.hpp"
+#include "taskgroup.hpp"
+#include "thread.hpp"
+#include "timer.hpp"
+#include "trace.hpp"
 #include "uuid.hpp"
 
 #endif // __TERREATECORE_HPP__
@@ -0,0 +1,131 @@
+#ifndef __TERREATECORE_ARENA_HPP__
+#define __TERREATECORE_ARENA_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "defines.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+/*
+ * @brief: Bump allocator for short-lived scratch memory. Allocation moves a
+ * pointer forward and nothing is freed individually; Rewind() and Reset()
+ * release everything allocated after a point at once. Chunks are kept for
+ * reuse, so a warmed-up arena does not touch the global allocator. Not
+ * thread-safe: every thread uses its own arena.
+ */
+class ScratchArena {
+private:
+  struct Chunk {
+    UniquePtr<Ubyte[]> data;
+    Size size = 0u;
+  };
+
+public:
+  struct Marker {
+    Size chunk = 0u;
+    Size offset = 0u;
+  };
+
+private:
+  Vec<Chunk> mChunks;
+  Size mChunk = 0u;
+  Size mOffset = 0u;
+  Size mChunkSize;
+
+private:
+  void *AllocateSlow(Size const &size, Size const &alignment);
+
+public:
+  /*
+   * @param: chunkSize: Size of the first chunk; later chunks double
+   */
+  explicit ScratchArena(Size const &chunkSize = 64u * 1024u);
+  ScratchArena(ScratchArena const &) = delete;
+  ScratchArena &operator=(ScratchArena const &) = delete;
+
+  Size GetCapacity() const;
+  Size GetNumChunks() const { return mChunks.size(); }
+
+  /*
+   * @brief: Allocate uninitialized memory.
+   * @param: size: Number of bytes
+   * @param: alignment: Power-of-two alignment
+   * @return: Memory valid until the arena is rewound past it
+   */
+  void *Allocate(Size const &size,
+                 Size const &alignment = alignof(std::max_align_t)) {
+    if (mChunk < mChunks.size()) {
+      Chunk &chunk = mChunks[mChunk];
+      std::uintptr_t base = reinterpret_cast<std::uintptr_t>(chunk.data.get());
+      std::uintptr_t aligned =
+          (base + mOffset + alignment - 1) & ~(std::uintptr_t(alignment) - 1);
+      Size end = static_cast<Size>(aligned - base) + size;
+      if (end <= chunk.size) {
+        mOffset = end;
+        return reinterpret_cast<void *>(aligned);
+      }
+    }
+    return this->AllocateSlow(size, alignment);
+  }
+
+  Marker GetMarker() const { return {mChunk, mOffset}; }
+  /*
+   * @brief: Release everything allocated since the marker was taken.
+   * @param: marker: Result of an earlier GetMarker()
+   */
+  void Rewind(Marker const &marker) {
+    mChunk = marker.chunk;
+    mOffset = marker.offset;
+  }
+  /*
+   * @brief: Release everything. The chunks stay allocated.
+   */
+  void Reset() { this->Rewind({}); }
+};
+
+/*
+ * @brief: STL allocator drawing from a ScratchArena. Deallocation does
+ * nothing; the memory comes back when the arena is rewound, so containers
+ * using it must not outlive that point.
+ * Usage: ArenaVec<int> values{ArenaAllocator<int>(arena)};
+ */
+template <typename T> class ArenaAllocator {
+private:
+  ScratchArena *mArena;
+
+  template <typename U> friend class ArenaAllocator;
+
+public:
+  using value_type = T;
+
+public:
+  explicit ArenaAllocator(ScratchArena &arena) : mArena(&arena) {}
+  template <typename U>
+  ArenaAllocator(ArenaAllocator<U> const &other) : mArena(other.mArena) {}
+
+  ScratchArena &GetArena() const { return *mArena; }
+
+  T *allocate(Size n) {
+    return static_cast<T *>(mArena->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *, Size) {}
+
+  template <typename U> Bool operator==(ArenaAllocator<U> const &other) const {
+    return mArena == other.mArena;
+  }
+  template <typename U> Bool operator!=(ArenaAllocator<U> const &other) const {
+    return mArena != other.mArena;
+  }
+};
+
+// Arena-backed counterparts of Vec and Map.
+template <typename T> using ArenaVec = std::vector<T, ArenaAllocator<T>>;
+template <typename S, typename T>
+using ArenaMap = std::unordered_map<S, T, std::hash<S>, std::equal_to<S>,
+                                    ArenaAllocator<std::pair<S const, T>>>;
+} // namespace TerreateCore::Utils
+
+#endif // __TERREATECORE_ARENA_HPP__
@@ -0,0 +1,250 @@
+#ifndef __TERREATECORE_COROUTINE_HPP__
+#define __TERREATECORE_COROUTINE_HPP__
+
+#include <coroutine>
+#include <variant>
+
+#include "defines.hpp"
+#include "executor.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+template <typename T> class Task;
+
+/*
+ * @brief: Promise state shared by every Task. Tasks start lazily when they
+ * are awaited and resume their awaiter by symmetric transfer when they
+ * finish, so a chain of awaits never blocks a thread.
+ */
+class TaskPromiseBase {
+private:
+  std::coroutine_handle<> mContinuation = std::noop_coroutine();
+
+protected:
+  ExceptionPtr mException;
+
+public:
+  struct FinalAwaiter {
+    Bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> coroutine) noexcept {
+      return coroutine.promise().mContinuation;
+    }
+    void await_resume() const noexcept {}
+  };
+
+public:
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() { mException = std::current_exception(); }
+
+  void SetContinuation(std::coroutine_handle<> continuation) {
+    mContinuation = continuation;
+  }
+};
+
+template <typename T> class TaskPromise : public TaskPromiseBase {
+private:
+  std::variant<std::monostate, T> mValue;
+
+public:
+  Task<T> get_return_object();
+  template <typename U> void return_value(U &&value) {
+    mValue.template emplace<1>(std::forward<U>(value));
+  }
+
+  T TakeResult() {
+    if (mException) {
+      std::rethrow_exception(mException);
+    }
+    return std::move(std::get<1>(mValue));
+  }
+};
+
+template <> class TaskPromise<void> : public TaskPromiseBase {
+public:
+  Task<void> get_return_object();
+  void return_void() const noexcept {}
+
+  void TakeResult() {
+    if (mException) {
+      std::rethrow_exception(mException);
+    }
+  }
+};
+
+/*
+ * @brief: Lazily started coroutine producing a T. Awaiting a Task starts it
+ * and suspends the awaiter until it finishes; the result or exception is
+ * returned by value from co_await. Use co_await executor.Schedule() inside
+ * the coroutine to move onto a worker and SyncWait() to drive a Task from
+ * ordinary code.
+ */
+template <typename T = void> class Task {
+public:
+  using promise_type = TaskPromise<T>;
+
+private:
+  std::coroutine_handle<promise_type> mCoroutine;
+
+public:
+  class Awaiter {
+  private:
+    std::coroutine_handle<promise_type> mCoroutine;
+
+  public:
+    explicit Awaiter(std::coroutine_handle<promise_type> coroutine)
+        : mCoroutine(coroutine) {}
+
+    Bool await_ready() const noexcept { return mCoroutine.done(); }
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> awaiting) noexcept {
+      mCoroutine.promise().SetContinuation(awaiting);
+      return mCoroutine;
+    }
+    T await_resume() { return mCoroutine.promise().TakeResult(); }
+  };
+
+public:
+  Task() = default;
+  explicit Task(std::coroutine_handle<promise_type> coroutine)
+      : mCoroutine(coroutine) {}
+  Task(Task const &) = delete;
+  Task(Task &&other) noexcept : mCoroutine(other.mCoroutine) {
+    other.mCoroutine = nullptr;
+  }
+  ~Task() {
+    if (mCoroutine) {
+      mCoroutine.destroy();
+    }
+  }
+
+  Bool Valid() const { return static_cast<Bool>(mCoroutine); }
+  Bool Done() const { return mCoroutine && mCoroutine.done(); }
+
+  Task &operator=(Task const &) = delete;
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (mCoroutine) {
+        mCoroutine.destroy();
+      }
+      mCoroutine = other.mCoroutine;
+      other.mCoroutine = nullptr;
+    }
+    return *this;
+  }
+
+  Awaiter operator co_await() const noexcept { return Awaiter(mCoroutine); }
+};
+
+/*
+ * @brief: Run a Task to completion from non-coroutine code. The calling
+ * thread runs queued executor tasks while it waits.
+ * @param: executor: Executor the task schedules itself on
+ * @param: task: Task to be run
+ * @return: Result of the task. Its exception is rethrown here.
+ */
+template <typename T> T SyncWait(Executor &executor, Task<T> task);
+} // namespace TerreateCore::Utils
+
+// Implementation
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+template <typename T> Task<T> TaskPromise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+  return Task<void>(
+      std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/*
+ * @brief: Detached coroutine used by SyncWait to signal completion.
+ */
+class SyncWaitTask {
+public:
+  struct promise_type {
+    SharedPtr<Atomic<Bool>> done;
+
+    struct FinalAwaiter {
+      Bool await_ready() const noexcept { return false; }
+      void
+      await_suspend(std::coroutine_handle<promise_type> coroutine) noexcept {
+        // Keep the flag alive on this stack: the waiting thread may destroy
+        // the frame as soon as it sees the store.
+        SharedPtr<Atomic<Bool>> done = coroutine.promise().done;
+        done->store(true);
+        done->notify_all();
+      }
+      void await_resume() const noexcept {}
+    };
+
+    SyncWaitTask get_return_object() {
+      return SyncWaitTask(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+
+private:
+  std::coroutine_handle<promise_type> mCoroutine;
+
+public:
+  explicit SyncWaitTask(std::coroutine_handle<promise_type> coroutine)
+      : mCoroutine(coroutine) {}
+  SyncWaitTask(SyncWaitTask const &) = delete;
+  SyncWaitTask(SyncWaitTask &&other) noexcept
+      : mCoroutine(other.mCoroutine) {
+    other.mCoroutine = nullptr;
+  }
+  ~SyncWaitTask() {
+    if (mCoroutine) {
+      mCoroutine.destroy();
+    }
+  }
+
+  void Start(SharedPtr<Atomic<Bool>> const &done) {
+    mCoroutine.promise().done = done;
+    mCoroutine.resume();
+  }
+};
+
+template <typename T> T SyncWait(Executor &executor, Task<T> task) {
+  using Result = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+  std::variant<std::monostate, Result, ExceptionPtr> result;
+
+  auto body = [](Task<T> &task, auto &result) -> SyncWaitTask {
+    try {
+      if constexpr (std::is_void_v<T>) {
+        co_await task;
+        result.template emplace<1>();
+      } else {
+        result.template emplace<1>(co_await task);
+      }
+    } catch (...) {
+      result.template emplace<2>(std::current_exception());
+    }
+  };
+
+  SharedPtr<Atomic<Bool>> done = std::make_shared<Atomic<Bool>>(false);
+  SyncWaitTask waiter = body(task, result);
+  waiter.Start(done);
+  executor.WaitUntil(*done, true);
+
+  if (result.index() == 2) {
+    std::rethrow_exception(std::get<2>(result));
+  }
+  if constexpr (!std::is_void_v<T>) {
+    return std::move(std::get<1>(result));
+  }
+}
+} // namespace TerreateCore::Utils
+
+#endif // __TERREATECORE_COROUTINE_HPP__
@@ -9,6 +9,7 @@
 #include <fstream>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <sstream>
@@ -74,6 +75,8 @@ template <typename T> using Pair = std::pair<T, T>;
 template <typename T> using Set = std::unordered_set<T>;
 template <typename T> using Vec = std::vector<T>;
 template <typename T> using Function = std::function<T>;
+template <typename T> using UniquePtr = std::unique_ptr<T>;
+template <typename T> using SharedPtr = std::shared_ptr<T>;
 
 // Job system types
 typedef std::mutex Mutex;
@@ -92,9 +95,6 @@ template <typename T> using Atomic = std::atomic<T>;
 template <typename T> using SharedFuture = std::shared_future<T>;
 template <typename T> using PackagedTask = std::packaged_task<T>;
 
-typedef SharedFuture<void> Handle;
-typedef PackagedTask<void()> Task;
-
 // Chrono types
 namespace chrono = std::chrono;
 typedef chrono::milliseconds MilliSec;
@@ -1,67 +1,521 @@
 #ifndef __TERREATECORE_EVENT_HPP__
 #define __TERREATECORE_EVENT_HPP__
 
+#include <tuple>
+
 #include "defines.hpp"
+#include "executor.hpp"
+#include "lockfree.hpp"
 #include "object.hpp"
 
 namespace TerreateCore::Utils {
 using namespace TerreateCore::Defines;
 
+/*
+ * @brief: Owner of the slots Subscription tokens refer to.
+ */
+class SubscriptionSource {
+public:
+  virtual ~SubscriptionSource() = default;
+
+  virtual void Unsubscribe(Uint const &index, Uint const &generation) = 0;
+};
+
+/*
+ * @brief: Move-only token of one Event subscription. Destroying the token
+ * or calling Unsubscribe() removes the callback; Detach() keeps it for the
+ * lifetime of the event. A token must not outlive its event.
+ */
+class Subscription {
+private:
+  SubscriptionSource *mSource = nullptr;
+  Uint mIndex = 0u;
+  Uint mGeneration = 0u;
+
+public:
+  Subscription() = default;
+  Subscription(SubscriptionSource *source, Uint const &index,
+               Uint const &generation)
+      : mSource(source), mIndex(index), mGeneration(generation) {}
+  Subscription(Subscription const &) = delete;
+  Subscription(Subscription &&other) noexcept;
+  ~Subscription() { this->Unsubscribe(); }
+
+  Bool IsActive() const { return mSource != nullptr; }
+
+  /*
+   * @brief: Remove the callback from the event. Publishes already running
+   * may still call it once; later ones will not. Does nothing if the token
+   * is empty.
+   */
+  void Unsubscribe();
+  /*
+   * @brief: Let go of the token without unsubscribing.
+   */
+  void Detach() { mSource = nullptr; }
+
+  Subscription &operator=(Subscription const &) = delete;
+  Subscription &operator=(Subscription &&other) noexcept;
+};
+
+/*
+ * @brief: Multicast event. The subscriber list is an immutable snapshot that
+ * Subscribe replaces copy-on-write, so Publish takes no lock: any number of
+ * threads may publish at once, and callbacks may subscribe, unsubscribe or
+ * publish again. Each snapshot counts its own publishers in a few padded
+ * reader slots, and a replaced snapshot is recycled as soon as they have
+ * left, by the next writer or by the last publisher to leave. Recycled
+ * snapshots drop their subscriber list but stay allocated until the event
+ * is destroyed, since a publisher that lost the race against a writer may
+ * still count itself in one before it retries.
+ * Subscribers are addressed through a slot map, so unsubscribing only
+ * clears a flag; dead entries are compacted away once they outnumber the
+ * live ones.
+ */
 template <typename... EventArgs>
-class Event final : public Core::TerreateObjectBase {
+class Event final : public Core::TerreateObjectBase,
+                    private SubscriptionSource {
 public:
   using Callback = Function<void(EventArgs...)>;
+  using Arguments = std::tuple<std::decay_t<EventArgs>...>;
+
+private:
+  static constexpr Size sNumReaderSlots = 8u;
+
+  struct Entry {
+    Callback callback;
+    Atomic<Bool> active = true;
+
+    explicit Entry(Callback &&target) : callback(std::move(target)) {}
+  };
+
+  struct alignas(64) ReaderSlot {
+    Atomic<Size> numReaders = 0u;
+  };
+
+  struct Snapshot {
+    ReaderSlot readers[sNumReaderSlots];
+    Vec<Entry *> entries;
+    // Entries the next snapshot dropped. Older snapshots may still list
+    // them, so they are handed to the newest older snapshot still in use
+    // and freed with the last one.
+    Vec<Entry *> dropped;
+    Atomic<Bool> retired = false;
+
+    ~Snapshot() {
+      for (auto *entry : dropped) {
+        delete entry;
+      }
+    }
+
+    Bool HasReaders() const {
+      for (auto const &slot : readers) {
+        if (slot.numReaders.load() != 0) {
+          return true;
+        }
+      }
+      return false;
+    }
+  };
+
+  struct Slot {
+    Entry *entry = nullptr;
+    Uint generation = 0u;
+  };
+
+  // Keeps the publisher counted in its snapshot while callbacks run, even
+  // if one throws. The guard may be released on another thread than the
+  // one taking it.
+  class ReadGuard {
+  private:
+    Event *mEvent;
+    Snapshot *mSnapshot;
+    Size mSlot;
+
+  public:
+    explicit ReadGuard(Event *event)
+        : mEvent(event), mSlot(Event::GetReaderSlot()) {
+      // A writer that replaced the snapshot in between may already have
+      // seen it unread, so only a snapshot that is still current counts.
+      while (true) {
+        mSnapshot = event->mSnapshot.load();
+        mSnapshot->readers[mSlot].numReaders.fetch_add(1);
+        if (event->mSnapshot.load() == mSnapshot) {
+          return;
+        }
+        this->Leave();
+      }
+    }
+    ReadGuard(ReadGuard const &) = delete;
+    ~ReadGuard() { this->Leave(); }
+
+    void Leave() {
+      // Read before leaving; the snapshot may be recycled right after.
+      Bool retired = mSnapshot->retired.load();
+      if (mSnapshot->readers[mSlot].numReaders.fetch_sub(1) == 1 && retired) {
+        mEvent->TryReclaim();
+      }
+    }
+
+    Snapshot const *Get() const { return mSnapshot; }
+
+    ReadGuard &operator=(ReadGuard const &) = delete;
+  };
+
+  // Shared by the tasks of one PublishAsync; the snapshot stays readable
+  // until the last of them lets go.
+  struct AsyncPublish {
+    ReadGuard guard;
+    Snapshot const *snapshot;
+    Arguments arguments;
+    Atomic<Bool> failed = false;
+    ExceptionPtr error;
+
+    AsyncPublish(Event *event, Arguments &&args)
+        : guard(event), snapshot(guard.Get()), arguments(std::move(args)) {}
+  };
 
 private:
+  Atomic<Snapshot *> mSnapshot;
+  // Serializes writers and guards everything below; Publish never takes it.
   Mutex mEventMutex;
-  Vec<Callback> mCallbacks;
-  Vec<Callback> mTriggers;
+  // Replaced snapshots still being read, oldest first.
+  Vec<Snapshot *> mRetired;
+  Vec<UniquePtr<Snapshot>> mSnapshots;
+  Vec<Snapshot *> mFreeSnapshots;
+  Vec<Slot> mSlots;
+  Vec<Uint> mFreeSlots;
+  Size mNumDead = 0u;
+
+private:
+  static Size GetReaderSlot() {
+    thread_local Size const slot =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) %
+        sNumReaderSlots;
+    return slot;
+  }
+
+  // Requires mEventMutex.
+  Snapshot *NewSnapshot() {
+    if (mFreeSnapshots.empty()) {
+      mSnapshots.emplace_back(new Snapshot());
+      return mSnapshots.back().get();
+    }
+    Snapshot *snapshot = mFreeSnapshots.back();
+    mFreeSnapshots.pop_back();
+    snapshot->retired.store(false);
+    return snapshot;
+  }
+  // Requires mEventMutex. A retired snapshot is no longer current, so its
+  // publishers can only leave; once none are left it can be recycled.
+  void Reclaim() {
+    Size numKept = 0u;
+    Snapshot *keeper = nullptr;
+    for (auto *snapshot : mRetired) {
+      if (snapshot->HasReaders()) {
+        keeper = snapshot;
+        mRetired[numKept++] = snapshot;
+        continue;
+      }
+      if (keeper != nullptr) {
+        keeper->dropped.insert(keeper->dropped.end(),
+                               snapshot->dropped.begin(),
+                               snapshot->dropped.end());
+      } else {
+        for (auto *entry : snapshot->dropped) {
+          delete entry;
+        }
+      }
+      snapshot->dropped = Vec<Entry *>();
+      snapshot->entries = Vec<Entry *>();
+      mFreeSnapshots.push_back(snapshot);
+    }
+    mRetired.resize(numKept);
+  }
+  void TryReclaim() {
+    UniqueLock<Mutex> lock(mEventMutex, std::try_to_lock);
+    if (lock.owns_lock()) {
+      this->Reclaim();
+    }
+  }
+  // Requires mEventMutex.
+  void Replace(Snapshot *snapshot, Vec<Entry *> &&dropped = {}) {
+    Snapshot *old = mSnapshot.exchange(snapshot);
+    old->dropped = std::move(dropped);
+    old->retired.store(true);
+    mRetired.push_back(old);
+    this->Reclaim();
+  }
+  // Requires mEventMutex.
+  void Compact() {
+    Snapshot *snapshot = this->NewSnapshot();
+    Vec<Entry *> dropped;
+    for (auto *entry : mSnapshot.load()->entries) {
+      if (entry->active.load(std::memory_order_relaxed)) {
+        snapshot->entries.push_back(entry);
+      } else {
+        dropped.push_back(entry);
+      }
+    }
+    mNumDead = 0u;
+    this->Replace(snapshot, std::move(dropped));
+  }
+
+  void Unsubscribe(Uint const &index, Uint const &generation) override {
+    LockGuard<Mutex> lock(mEventMutex);
+    Slot &slot = mSlots[index];
+    if (slot.generation != generation) {
+      return;
+    }
+    slot.entry->active.store(false, std::memory_order_relaxed);
+    slot.entry = nullptr;
+    ++slot.generation;
+    mFreeSlots.push_back(index);
+    if (++mNumDead * 2 > mSnapshot.load()->entries.size()) {
+      this->Compact();
+    }
+  }
 
 public:
-  Event() = default;
-  ~Event() override = default;
+  Event() { mSnapshot.store(this->NewSnapshot()); }
+  Event(Event const &) = delete;
+  ~Event() override {
+    // Dropped entries go with the snapshots in mSnapshots.
+    for (auto *entry : mSnapshot.load()->entries) {
+      delete entry;
+    }
+  }
+
+  /*
+   * @brief: Number of replaced subscriber snapshots that publishers may
+   * still be reading.
+   */
+  Size GetNumRetired() {
+    LockGuard<Mutex> lock(mEventMutex);
+    return mRetired.size();
+  }
 
   /*
    * @brief: Subscribe to the event
    * @param: subscriber: Callback function to be called when the event is
+   * published
+   * @return: Token that unsubscribes the callback when destroyed; discarding
+   * it would unsubscribe right away, so use operator+= to subscribe for the
+   * lifetime of the event
    */
-  void Subscribe(Callback subscriber) {
+  [[nodiscard]] Subscription Subscribe(Callback subscriber) {
     LockGuard<Mutex> lock(mEventMutex);
-    mCallbacks.push_back(subscriber);
+    Entry *entry = new Entry(std::move(subscriber));
+    Snapshot *snapshot = this->NewSnapshot();
+    snapshot->entries = mSnapshot.load()->entries;
+    snapshot->entries.push_back(entry);
+    this->Replace(snapshot);
+
+    Uint index;
+    if (mFreeSlots.empty()) {
+      index = static_cast<Uint>(mSlots.size());
+      mSlots.emplace_back();
+    } else {
+      index = mFreeSlots.back();
+      mFreeSlots.pop_back();
+    }
+    mSlots[index].entry = entry;
+    return Subscription(this, index, mSlots[index].generation);
   }
   /*
    * @brief: Unsubscribe from the event
-   * @param: callback: Callback function to be removed from the event
+   * @param: subscription: Token returned by Subscribe()
    */
-  void Unsubscribe(Callback callback) {
-    UniqueLock<Mutex> lock(mEventMutex);
-    mCallbacks.erase(
-        std::remove(mCallbacks.begin(), mCallbacks.end(), callback),
-        mCallbacks.end());
-  }
+  void Unsubscribe(Subscription &subscription) { subscription.Unsubscribe(); }
 
   /*
-   * @brief: Publish the event
+   * @brief: Publish the event. Callbacks see the subscribers as they were
+   * when the call started, minus those unsubscribed meanwhile.
    * @param: args: Arguments to be passed to the callback functions
    */
   void Publish(EventArgs... args) {
-    UniqueLock<Mutex> lock(mEventMutex);
-    for (auto &callback : mCallbacks) {
-      callback(std::forward<EventArgs>(args)...);
+    ReadGuard guard(this);
+    Snapshot const *snapshot = guard.Get();
+    for (auto const *entry : snapshot->entries) {
+      if (entry->active.load(std::memory_order_relaxed)) {
+        entry->callback(args...);
+      }
     }
-    for (auto &callback : mTriggers) {
-      callback(std::forward<EventArgs>(args)...);
+  }
+
+  /*
+   * @brief: Publish several events, handing the whole batch to one
+   * subscriber before moving on to the next so each callback stays hot. A
+   * throwing callback does not stop delivery of the rest of the batch.
+   * @param: batch: Arguments of each event, in delivery order
+   * @throw: The first exception thrown by a callback, once the whole batch
+   * has been delivered
+   */
+  void PublishBatch(Vec<Arguments> const &batch) {
+    ExceptionPtr error;
+    {
+      ReadGuard guard(this);
+      Snapshot const *snapshot = guard.Get();
+      for (auto const *entry : snapshot->entries) {
+        if (!entry->active.load(std::memory_order_relaxed)) {
+          continue;
+        }
+        for (auto const &arguments : batch) {
+          try {
+            std::apply(entry->callback, arguments);
+          } catch (...) {
+            if (!error) {
+              error = std::current_exception();
+            }
+          }
+        }
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
     }
   }
 
+  /*
+   * @brief: Publish the event on an executor. Subscribers are split into
+   * chunks that run as parallel tasks sharing one copy of the arguments. A
+   * throwing callback does not stop the others. The event must outlive the
+   * returned handle.
+   * @param: executor: Executor running the callbacks
+   * @param: args: Arguments to be passed to the callback functions
+   * @return: Handle completing once every callback has returned; Get()
+   * rethrows the first exception thrown by a callback
+   */
+  Handle PublishAsync(Executor &executor, EventArgs... args) {
+    auto state = std::make_shared<AsyncPublish>(this, Arguments(args...));
+    Size count = state->snapshot->entries.size();
+    Size chunkSize =
+        std::max<Size>(1u, count / (executor.GetNumWorkers() * 8u));
+
+    Vec<Handle> chunks;
+    chunks.reserve((count + chunkSize - 1) / chunkSize);
+    for (Size begin = 0; begin < count; begin += chunkSize) {
+      Size end = std::min(begin + chunkSize, count);
+      chunks.push_back(executor.Schedule([state, begin, end]() {
+        for (Size i = begin; i < end; ++i) {
+          Entry const *entry = state->snapshot->entries[i];
+          if (!entry->active.load(std::memory_order_relaxed)) {
+            continue;
+          }
+          try {
+            std::apply(entry->callback, state->arguments);
+          } catch (...) {
+            if (!state->failed.exchange(true)) {
+              state->error = std::current_exception();
+            }
+          }
+        }
+      }));
+    }
+    return executor.Schedule(
+        [state = std::move(state)]() {
+          if (state->error) {
+            std::rethrow_exception(state->error);
+          }
+        },
+        chunks);
+  }
+
+  // Subscribe for the lifetime of the event.
   Event &operator+=(Callback callback) {
-    this->Subscribe(callback);
+    this->Subscribe(std::move(callback)).Detach();
     return *this;
   }
-  Event &operator-=(Callback callback) {
-    this->Unsubscribe(callback);
+
+  Event &operator=(Event const &) = delete;
+};
+
+/*
+ * @brief: Event whose publishes are queued and delivered later in one batch.
+ * Publish copies the arguments into a lock-free ring buffer and may be
+ * called from any thread; Flush() hands everything queued so far to each
+ * subscriber in turn. Meant for high-frequency events such as input or
+ * physics contacts that are consumed once per frame. The decayed argument
+ * types must be default-constructible, since each queued event is popped
+ * into a default-constructed tuple.
+ */
+template <typename... EventArgs>
+class QueuedEvent final : public Core::TerreateObjectBase {
+public:
+  using Callback = typename Event<EventArgs...>::Callback;
+  using Arguments = typename Event<EventArgs...>::Arguments;
+
+private:
+  static_assert(std::is_default_constructible_v<Arguments>,
+                "QueuedEvent requires default-constructible arguments.");
+
+  Event<EventArgs...> mEvent;
+  MPMCQueue<Arguments> mQueue;
+  Vec<Arguments> mBatch;
+
+public:
+  /*
+   * @param: capacity: Number of events that can be queued between flushes;
+   * rounded up to a power of two
+   */
+  explicit QueuedEvent(Size const &capacity = 1024u) : mQueue(capacity) {
+    mBatch.reserve(mQueue.Capacity());
+  }
+  QueuedEvent(QueuedEvent const &) = delete;
+  ~QueuedEvent() override = default;
+
+  Size GetCapacity() const { return mQueue.Capacity(); }
+  Bool IsEmpty() const { return mQueue.Empty(); }
+
+  /*
+   * @brief: Subscribe to the event
+   * @param: subscriber: Callback function to be called on Flush()
+   * @return: Token that unsubscribes the callback when destroyed, as with
+   * Event::Subscribe()
+   */
+  [[nodiscard]] Subscription Subscribe(Callback subscriber) {
+    return mEvent.Subscribe(std::move(subscriber));
+  }
+
+  /*
+   * @brief: Queue the event for the next Flush().
+   * @param: args: Arguments to be passed to the callback functions
+   * @return: Whether the event was queued; false if the queue is full
+   */
+  Bool Publish(EventArgs... args) {
+    return mQueue.TryPush(Arguments(args...));
+  }
+  /*
+   * @brief: Deliver every queued event. Events published by the callbacks
+   * are left for the next flush. Only one thread may flush at a time.
+   * @return: Number of events delivered
+   * @throw: The first exception thrown by a callback, after every event has
+   * been delivered to every subscriber
+   */
+  Size Flush() {
+    Arguments arguments;
+    while (mBatch.size() < mQueue.Capacity() && mQueue.TryPop(arguments)) {
+      mBatch.push_back(std::move(arguments));
+    }
+    Size numEvents = mBatch.size();
+    if (numEvents != 0) {
+      try {
+        mEvent.PublishBatch(mBatch);
+      } catch (...) {
+        mBatch.clear();
+        throw;
+      }
+      mBatch.clear();
+    }
+    return numEvents;
+  }
+
+  QueuedEvent &operator+=(Callback callback) {
+    mEvent += std::move(callback);
     return *this;
   }
+
+  QueuedEvent &operator=(QueuedEvent const &) = delete;
 };
 } // namespace TerreateCore::Utils
 
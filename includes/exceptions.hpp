@@ -31,6 +31,11 @@ public:
   TaskError(Str const &message) noexcept : TerreateCoreException(message) {}
 };
 
+class TaskCancelled : public TaskError {
+public:
+  TaskCancelled(Str const &message) noexcept : TaskError(message) {}
+};
+
 class NullReferenceException : public TerreateCoreException {
 public:
   NullReferenceException(Str const &message) noexcept
@@ -1,42 +1,654 @@
 #ifndef __TERREATECORE_EXECUTOR_HPP__
 #define __TERREATECORE_EXECUTOR_HPP__
 
+#include <coroutine>
+#include <mutex>
+#include <ranges>
+
+#include "arena.hpp"
 #include "defines.hpp"
+#include "lockfree.hpp"
 #include "object.hpp"
+#include "replay.hpp"
+#include "task.hpp"
+#include "timer.hpp"
 
 namespace TerreateCore::Utils {
 using namespace TerreateCore::Defines;
 
 typedef Function<void()> Runnable;
 
+enum class SchedulingMode {
+  // Every worker pulls from one shared queue.
+  SingleQueue,
+  // Every worker owns a deque. Tasks scheduled from inside a task go to the
+  // local deque and idle workers steal from the others.
+  WorkStealing
+};
+
+enum class ReplayMode : Ubyte {
+  Off,
+  // Log the start order and worker of every labelled task.
+  Record,
+  // Run labelled tasks one at a time in logged order on their logged worker.
+  Replay
+};
+
+enum class ArenaReset : Ubyte {
+  // Everything a task allocates from CurrentArena() is released when it
+  // returns.
+  PerTask,
+  // Allocations accumulate until ResetArenas(), e.g. once per frame.
+  Manual
+};
+
+/*
+ * @brief: Construction options of an Executor.
+ */
+struct ExecutorOptions {
+  Uint numWorkers = std::thread::hardware_concurrency();
+  SchedulingMode mode = SchedulingMode::SingleQueue;
+  // Workers are named "<workerName>-<index>" unless this is empty.
+  Str workerName = "";
+  // Pin worker i to cpus[i % cpus.size()], or to the i-th online CPU in node
+  // order when cpus is empty.
+  Bool pinWorkers = false;
+  Vec<Uint> cpus = {};
+  // Spread workers over the NUMA nodes, keep each one on its node's CPUs and
+  // steal from workers of the same node first.
+  Bool groupByNumaNode = false;
+  // An idle worker polls with a pause instruction for up to idleSpins rounds,
+  // then yields for idleYields rounds, and only then parks. Zero skips a
+  // phase; both zero parks straight away.
+  Uint idleSpins = 256;
+  Uint idleYields = 8;
+  // Double a worker's spin budget whenever spinning finds work and halve it
+  // whenever it does not, so workers spin through bursts but stop burning
+  // CPU once arrivals thin out.
+  Bool adaptiveIdle = true;
+  // Names of pinned queues. Tasks posted to one of them run only on the
+  // thread that calls PumpPinned for it.
+  Vec<Str> pinnedQueues = {};
+  // First chunk size of every worker's scratch arena and when it is reset.
+  Size arenaSize = 64u * 1024u;
+  ArenaReset arenaReset = ArenaReset::PerTask;
+};
+
+/*
+ * @brief: Queueing latency of one priority lane, measured from the moment a
+ * task becomes runnable until a thread starts it.
+ */
+struct LaneMetrics {
+  Size numTasks = 0u;
+  NanoSec totalWait = NanoSec(0);
+  NanoSec maxWait = NanoSec(0);
+  // Deadline tasks of this lane that completed after their deadline.
+  Size numMissedDeadlines = 0u;
+
+  NanoSec MeanWait() const {
+    return numTasks == 0 ? NanoSec(0)
+                         : totalWait / static_cast<Long>(numTasks);
+  }
+};
+
+/*
+ * @brief: How idle workers spent their time, summed over every worker.
+ */
+struct IdleMetrics {
+  // Idle periods that spun or yielded, and how many of them found work.
+  Size numSpins = 0u;
+  Size numSpinHits = 0u;
+  // Times a worker parked, and wake-ups sent to parked workers.
+  Size numParks = 0u;
+  Size numWakeups = 0u;
+  NanoSec spinTime = NanoSec(0);
+};
+
+class ScheduleAwaiter;
+
 class Executor : public Core::TerreateObjectBase {
 private:
-  Vec<Handle> mHandles;
-  Queue<Task> mTaskQueue;
-  Mutex mQueueMutex;
+  static constexpr Size sInjectQueueCapacity = 1u << 14;
+  static constexpr Size sErrorChannelCapacity = 256u;
+  static constexpr Uint sNumLanes = 3u;
+  // Every n-th pick looks at the background lane before the normal one.
+  static constexpr Uint sFairnessInterval = 8u;
+  static thread_local Executor *sCurrentExecutor;
+  static thread_local Uint sWorkerIndex;
+  static thread_local Uint sNumPicks;
+  static thread_local ScratchArena *sArena;
+  // Labels past this many are not recorded.
+  static constexpr Uint sMaxReplayLabels = 4096u;
+  // How long every outstanding task has to be held back by a replay before
+  // the run is taken to have diverged from the log.
+  static constexpr MilliSec sReplayStallTimeout = MilliSec(100);
+  static Atomic<Ulong> sNumReplayGenerations;
+
+  struct LaneCounters {
+    Atomic<Size> numTasks = 0u;
+    Atomic<Long> totalWait = 0;
+    Atomic<Long> maxWait = 0;
+    Atomic<Size> numMissedDeadlines = 0u;
+  };
+
+  struct IdleCounters {
+    Atomic<Size> numSpins = 0u;
+    Atomic<Size> numSpinHits = 0u;
+    Atomic<Size> numParks = 0u;
+    Atomic<Size> numWakeups = 0u;
+    Atomic<Long> spinTime = 0;
+  };
+
+  // Producers push onto `incoming` with a CAS; the owning thread takes the
+  // whole list with one exchange and keeps it, oldest first, in `pending`.
+  struct PinnedQueue {
+    Str name;
+    alignas(64) Atomic<TaskBlock *> incoming = nullptr;
+    alignas(64) Atomic<std::thread::id> owner = std::thread::id();
+    TaskBlock *pending = nullptr;
+  };
+
+  struct ReplayRecord {
+    Ulong sequence = 0u;
+    Ulong generation = 0u;
+    ReplayEntry entry;
+  };
+
+  // Entries a thread recorded. Only that thread and StopRecording() touch
+  // it, so its mutex is uncontended.
+  struct ReplayBuffer {
+    std::thread::id owner;
+    Mutex mutex;
+    Vec<ReplayRecord> records;
+  };
+
+  // A recording thread's label ids and buffer, valid for one generation.
+  struct ReplayCache {
+    Ulong generation = 0u;
+    ReplayBuffer *buffer = nullptr;
+    Map<char const *, Uint> labels;
+  };
+
+  struct LaterDeadline {
+    Bool operator()(TaskBlock const *lhs, TaskBlock const *rhs) const {
+      return lhs->GetOptions().deadline > rhs->GetOptions().deadline;
+    }
+  };
+
+  // Deadline tasks of one lane, earliest deadline on top. `numTasks` lets
+  // TryPop skip the lock while the heap is empty.
+  struct DeadlineQueue {
+    Mutex mutex;
+    PriorityQueue<TaskBlock *, Vec<TaskBlock *>, LaterDeadline> blocks;
+    Atomic<Size> numTasks = 0u;
+  };
+
+private:
+  MPMCQueue<ExceptionPtr> mErrors;
+  Atomic<Size> mNumDroppedErrors = 0u;
+  // One injection queue per lane.
+  Vec<UniquePtr<MPMCQueue<TaskBlock *>>> mInjectQueues;
+  // One deadline heap per lane, served ahead of that lane's other tasks.
+  Vec<UniquePtr<DeadlineQueue>> mDeadlineQueues;
+  // Queued critical tasks, so other lanes can skip scanning for them.
+  Atomic<Size> mNumCriticalTasks = 0u;
+
+  SchedulingMode mMode;
+  // One deque per lane and worker, indexed by worker * sNumLanes + lane.
+  Vec<UniquePtr<WorkStealingDeque<TaskBlock *>>> mLocalQueues;
 
   Vec<Thread> mWorkers;
-  ConditionVariable mCV;
+  Vec<UniquePtr<PinnedQueue>> mPinnedQueues;
+  Vec<UniquePtr<ScratchArena>> mArenas;
+
+  // Record/replay of labelled tasks. A task's key is (label index + 1) << 32
+  // | occurrence, where occurrence counts the earlier tasks of that label to
+  // become runnable. Recording threads resolve labels through sReplayCache
+  // and log into their own buffer, ordered by mReplaySequence and merged by
+  // StopRecording(). In replay, logged tasks are held back until their turn
+  // and handed to their worker through mReplayReady.
+  static thread_local ReplayCache sReplayCache;
+  Mutex mReplayMutex;
+  Atomic<ReplayMode> mReplayMode = ReplayMode::Off;
+  Atomic<Ulong> mReplayGeneration = 0u;
+  Atomic<Ulong> mReplaySequence = 0u;
+  ReplayLog mReplayLog;
+  Map<Str, Uint> mReplayLabelIds;
+  Map<char const *, Uint> mReplayLabelCache;
+  Vec<Atomic<Uint>> mReplayOccurrences;
+  Vec<UniquePtr<ReplayBuffer>> mReplayBuffers;
+  Size mReplayCursor = 0u;
+  Set<Ulong> mReplayExpected;
+  Map<Ulong, TaskBlock *> mReplayHeld;
+  TaskBlock *mReplayRunning = nullptr;
+  Atomic<TaskBlock *> mReplayReady = nullptr;
+  Atomic<Uint> mReplayWorker = 0u;
+  Str mWorkerName;
+  // CPUs each worker is restricted to; empty when it is not pinned.
+  Vec<Vec<Uint>> mWorkerCpus;
+  // Victims each worker tries in turn when stealing.
+  Vec<Vec<Uint>> mStealOrder;
+
+  // Delayed tasks wait in the wheel, driven by one timer thread that is
+  // started by the first delayed task. The thread is started and stopped
+  // under mTimerMutex, so it is never started after StopTimers().
+  Mutex mTimerMutex;
+  ConditionVariable mTimerCondition;
+  TimerWheel mTimers;
+  SteadyTimePoint mTimerWakeAt = SteadyTimePoint::max();
+  Bool mTimerStop = false;
+  Thread mTimerThread;
+
+  Atomic<Bool> mMetricsEnabled = false;
+  LaneCounters mLaneCounters[sNumLanes];
+
+  Uint mIdleSpins;
+  Uint mIdleYields;
+  Bool mAdaptiveIdle;
+  ArenaReset mArenaReset;
+  IdleCounters mIdleCounters;
 
   Atomic<Uint> mNumJobs = 0u;
-  Atomic<Bool> mComplete = false;
+  Atomic<Uint> mNumSpinning = 0u;
+  Atomic<Uint> mNumSleeping = 0u;
+  // Set while a parked worker has been notified but has not run yet.
+  Atomic<Bool> mWakePending = false;
+  Atomic<Uint> mWakeEpoch = 0u;
+  // Threads blocked in Wait(), WaitForAll() or WaitUntil() sleep on
+  // mWaitEpoch, which new work and finished tasks bump while any are parked.
+  Atomic<Uint> mNumParkedWaiters = 0u;
+  Atomic<Uint> mWaitEpoch = 0u;
   Atomic<Bool> mStop = false;
 
 private:
-  void Worker();
+  void Worker(Uint const &index);
+  void PlaceWorkers(ExecutorOptions const &options);
+  void Submit(TaskBlock *block);
+  void SubmitAfter(TaskBlock *block, Vec<Handle> const &dependencies);
+  void SubmitAt(TaskBlock *block, SteadyTimePoint const &time);
+  void TimerLoop();
+  void StopTimers();
+  void Enqueue(TaskBlock *block);
+  void Stamp(TaskBlock *block);
+  void SubmitBatch(Vec<TaskBlock *> &blocks);
+  void Execute(TaskBlock *block);
+  void RunBlock(TaskBlock *block);
+  void SubmitPinned(ID const &queue, TaskBlock *block);
+  TaskBlock *PopPinned(PinnedQueue &queue);
+  Bool TryRunPinned();
+  Bool HasPinnedWork() const;
+  void DropPinned();
+  ReplayCache *GetReplayCache();
+  void AssignRecordKey(TaskBlock *block);
+  Bool AssignReplayKey(TaskBlock *block);
+  Bool HoldForReplay(TaskBlock *block);
+  void DispatchReplay();
+  void RecordReplay(TaskBlock *block);
+  Bool IsReplayStalled() const;
+  Bool ResolveReplayStall();
+  void FinishReplay(TaskBlock *block);
+  Bool TryPopReplay(TaskBlock *&block);
+  Bool HasReplayWork() const;
+  void RecordWait(TaskBlock const *block);
+  Bool TryPop(TaskBlock *&block);
+  void PushDeadline(TaskBlock *const *blocks, Size const &count);
+  Bool TryPopDeadline(Uint const &lane, TaskBlock *&block);
+  Bool TryPopLane(Uint const &lane, TaskBlock *&block);
+  Bool TrySteal(Uint const &index, Uint const &lane, TaskBlock *&block);
+  Bool TryRunOne();
+  Bool HasWork() const;
+  Bool Spin(Uint &spinLimit, TaskBlock *&block);
+  Bool Park();
+  void Wake();
+  void WakeMany(Size const &count);
+  void WakeWaiters();
+  template <typename F> void ParkWaiter(F const &isDone);
 
 public:
   explicit Executor(
-      Uint const &numWorkers = std::thread::hardware_concurrency());
+      Uint const &numWorkers = std::thread::hardware_concurrency(),
+      SchedulingMode const &mode = SchedulingMode::SingleQueue);
+  explicit Executor(ExecutorOptions const &options);
   ~Executor() override;
 
-  Vec<ExceptionPtr> GetExceptions() const;
+  SchedulingMode GetMode() const { return mMode; }
+  Uint GetNumWorkers() const { return static_cast<Uint>(mWorkers.size()); }
+  /*
+   * @brief: CPUs a worker is restricted to; empty if it is not pinned.
+   * @param: index: Worker index
+   */
+  Vec<Uint> const &GetWorkerCpus(Uint const &index) const {
+    return mWorkerCpus[index];
+  }
+  /*
+   * @brief: Take the exceptions of tasks that failed since the last call.
+   * Failures are collected into a bounded channel when they happen; once it
+   * is full further exceptions are dropped and only counted.
+   */
+  Vec<ExceptionPtr> GetExceptions();
+  Size GetNumDroppedExceptions() const { return mNumDroppedErrors.load(); }
+
+  /*
+   * @brief: Turn per-lane latency measurement on or off. It costs a clock
+   * read per task, so it is off by default.
+   */
+  void SetMetricsEnabled(Bool const &enabled) {
+    mMetricsEnabled.store(enabled);
+  }
+  Bool IsMetricsEnabled() const { return mMetricsEnabled.load(); }
+  /*
+   * @brief: Latency measured for a lane since the last reset.
+   * @param: priority: Lane to be read
+   */
+  LaneMetrics GetLaneMetrics(TaskPriority const &priority) const;
+  /*
+   * @brief: Spinning and parking counters of the workers since the last
+   * reset. These are always collected.
+   */
+  IdleMetrics GetIdleMetrics() const;
+  void ResetMetrics();
+
+  /*
+   * @brief: Schedule a task.
+   * @param: target: Callable to be run
+   * @param: options: Priority lane, optional deadline and cancellation token
+   * @return: Handle holding the callable's result
+   */
+  template <typename F>
+  TaskHandle<TaskResultT<F>> Schedule(F &&target,
+                                     TaskOptions const &options = {});
+  /*
+   * @brief: Schedule a range of callables as one submission. Queue slots are
+   * claimed for the whole batch at once and idle workers are woken
+   * together instead of once per task. Wait with WaitForAll or a TaskGroup.
+   * @param: targets: Range of callables; elements are moved from when the
+   * range is an owning rvalue such as a temporary vector, and copied when it
+   * is an lvalue or a borrowed view such as std::span
+   * @param: options: Options shared by every task of the batch
+   * @return: Number of tasks scheduled
+   */
+  template <typename Range>
+  Size ScheduleBatch(Range &&targets, TaskOptions const &options = {});
+  /*
+   * @brief: Awaitable that resumes the awaiting coroutine on a worker.
+   * Usage: co_await executor.Schedule();
+   */
+  ScheduleAwaiter Schedule();
+  /*
+   * @brief: Schedule a task that runs once every dependency has completed.
+   * The task is held back rather than queued, so no worker ever blocks on a
+   * dependency.
+   * @param: target: Callable to be run
+   * @param: dependencies: Tasks that must complete first
+   * @param: options: Priority lane, optional deadline and cancellation token
+   */
+  template <typename F>
+  TaskHandle<TaskResultT<F>> Schedule(F &&target,
+                                     Vec<Handle> const &dependencies,
+                                     TaskOptions const &options = {});
+
+  /*
+   * @brief: Schedule a task to be queued at a point in time. The task waits
+   * in a timer wheel rather than on a thread and is queued within one
+   * millisecond after the time. Tasks scheduled while the executor is being
+   * destroyed are cancelled.
+   * @param: time: When the task becomes runnable
+   * @param: target: Callable to be run
+   * @param: options: Priority lane, optional deadline and cancellation token
+   */
+  template <typename F>
+  TaskHandle<TaskResultT<F>> ScheduleAt(SteadyTimePoint const &time,
+                                       F &&target,
+                                       TaskOptions const &options = {});
+  /*
+   * @brief: Schedule a task to be queued after a delay.
+   * @param: delay: How long to wait
+   * @param: target: Callable to be run
+   * @param: options: Priority lane, optional deadline and cancellation token
+   */
+  template <typename Rep, typename Period, typename F>
+  TaskHandle<TaskResultT<F>>
+  ScheduleAfter(chrono::duration<Rep, Period> const &delay, F &&target,
+                TaskOptions const &options = {});
+  /*
+   * @brief: Drop a delayed task that is still waiting for its time. Its
+   * callable is destroyed and its handle reports TaskCancelled.
+   * @param: handle: Task returned by ScheduleAt or ScheduleAfter
+   * @return: False if the task already left the timer wheel
+   */
+  Bool CancelTimer(HandleBase const &handle);
+
+  /*
+   * @brief: Look up a pinned queue created through ExecutorOptions.
+   * @param: name: Name of the queue
+   * @return: Id to pass to SchedulePinned and PumpPinned
+   */
+  ID GetPinnedQueue(Str const &name) const;
+  /*
+   * @brief: Post a task to a pinned queue. Posting never locks, so workers
+   * do not contend with the thread that pumps the queue. Pinned tasks do not
+   * count towards WaitForAll. Tasks posted while the executor is being
+   * destroyed are cancelled.
+   * @param: queue: Id from GetPinnedQueue
+   * @param: target: Callable to be run
+   * @param: options: Only the cancellation token applies
+   */
+  template <typename F>
+  TaskHandle<TaskResultT<F>> SchedulePinned(ID const &queue, F &&target,
+                                           TaskOptions const &options = {});
+  /*
+   * @brief: Run tasks from a pinned queue on the calling thread, oldest
+   * first, until it is empty or the budget is spent. The first thread to
+   * pump a queue owns it. While it waits on this executor through Wait,
+   * WaitForAll or WaitUntil it also runs the queue's tasks, including ones
+   * posted after it started waiting.
+   * @param: queue: Id from GetPinnedQueue
+   * @param: budget: Time after which no further task is started; zero runs
+   * nothing
+   * @return: Number of tasks run
+   */
+  Size PumpPinned(ID const &queue, NanoSec const &budget = NanoSec::max());
 
-  Handle Schedule(Runnable const &target);
-  Handle Schedule(Runnable const &target, Vec<Handle> const &dependencies);
+  /*
+   * @brief: Scratch arena of the calling thread. Workers own one each;
+   * other threads get a thread-local one. Tasks can back temporary
+   * containers with it through ArenaAllocator instead of the global heap.
+   * @return: The arena
+   */
+  static ScratchArena &CurrentArena();
+  /*
+   * @brief: Reset every worker's arena and the caller's. Only call it while
+   * no task is running, e.g. after WaitForAll() at the end of a frame.
+   */
+  void ResetArenas();
+
+  /*
+   * @brief: Start logging labelled tasks (TaskOptions::label). Tasks are
+   * identified by label and by how many tasks of that label became runnable
+   * before them, so a replay matches only if every label is queued in the
+   * same order, e.g. from one thread.
+   */
+  void StartRecording();
+  /*
+   * @brief: Stop logging.
+   * @return: Everything logged since StartRecording()
+   */
+  ReplayLog StopRecording();
+  /*
+   * @brief: Replay a recorded run. Logged tasks are held back until every
+   * task logged before them has finished, then run on the worker they ran
+   * on, or on any thread if there is no such worker. Other tasks run as
+   * usual. Replay ends by itself after the last logged task. If the run
+   * diverges from the log, so that every outstanding task is held back for
+   * sReplayStallTimeout, replay is abandoned and the held tasks fail with
+   * ExecutorError instead of running.
+   * @param: log: Log from StopRecording()
+   */
+  void StartReplay(ReplayLog const &log);
+  /*
+   * @brief: Abandon a replay and queue every task it still holds back.
+   */
+  void StopReplay();
+  ReplayMode GetReplayMode() const { return mReplayMode.load(); }
+  /*
+   * @brief: Number of logged tasks replayed so far.
+   */
+  Size GetReplayPosition();
+
+  /*
+   * @brief: Wait until every scheduled task has completed. The calling
+   * thread runs queued tasks while it waits instead of sitting idle, and
+   * wakes up for tasks queued after it ran out of work.
+   */
+  void WaitForAll();
+  /*
+   * @brief: Wait until a task has completed, running queued tasks on the
+   * calling thread in the meantime.
+   * @param: handle: Task to wait for
+   */
+  void Wait(HandleBase const &handle);
+  /*
+   * @brief: Wait until an atomic reaches a value, running queued tasks on the
+   * calling thread in the meantime. The value is checked again whenever a
+   * task of this executor finishes, so it must be stored by one.
+   * @param: value: Atomic to be watched
+   * @param: target: Value to wait for
+   */
+  template <typename T> void WaitUntil(Atomic<T> const &value, T const &target);
+};
+
+class ScheduleAwaiter {
+private:
+  Executor &mExecutor;
+
+public:
+  explicit ScheduleAwaiter(Executor &executor) : mExecutor(executor) {}
 
-  void WaitForAll() const { mComplete.wait(false); }
+  Bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> coroutine) {
+    mExecutor.Schedule([coroutine]() { coroutine.resume(); });
+  }
+  void await_resume() const noexcept {}
 };
 } // namespace TerreateCore::Utils
 
+// Implementation
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+template <typename F>
+TaskHandle<TaskResultT<F>> Executor::Schedule(F &&target,
+                                              TaskOptions const &options) {
+  TaskBlock *block = TaskBlock::Acquire();
+  block->Emplace(std::forward<F>(target));
+  block->SetOptions(options);
+  block->AttachToken();
+  TaskHandle<TaskResultT<F>> handle(block);
+  this->Submit(block);
+  return handle;
+}
+
+template <typename F>
+TaskHandle<TaskResultT<F>> Executor::ScheduleAt(SteadyTimePoint const &time,
+                                                F &&target,
+                                                TaskOptions const &options) {
+  TaskBlock *block = TaskBlock::Acquire();
+  block->Emplace(std::forward<F>(target));
+  block->SetOptions(options);
+  block->AttachToken();
+  TaskHandle<TaskResultT<F>> handle(block);
+  this->SubmitAt(block, time);
+  return handle;
+}
+
+template <typename Range>
+Size Executor::ScheduleBatch(Range &&targets, TaskOptions const &options) {
+  Vec<TaskBlock *> blocks;
+  if constexpr (std::ranges::sized_range<Range>) {
+    blocks.reserve(std::ranges::size(targets));
+  }
+  for (auto &&target : targets) {
+    TaskBlock *block = TaskBlock::Acquire();
+    // A borrowed range such as std::span does not own its elements, so an
+    // rvalue of it must not move them out from under the caller.
+    if constexpr (std::is_rvalue_reference_v<Range &&> &&
+                  !std::ranges::borrowed_range<Range>) {
+      block->Emplace(std::move(target));
+    } else {
+      block->Emplace(target);
+    }
+    block->SetOptions(options);
+    block->AttachToken();
+    blocks.push_back(block);
+  }
+  Size numTasks = blocks.size();
+  this->SubmitBatch(blocks);
+  return numTasks;
+}
+
+template <typename F>
+TaskHandle<TaskResultT<F>> Executor::SchedulePinned(ID const &queue,
+                                                    F &&target,
+                                                    TaskOptions const &options) {
+  TaskBlock *block = TaskBlock::Acquire();
+  block->Emplace(std::forward<F>(target));
+  block->SetOptions(options);
+  block->AttachToken();
+  TaskHandle<TaskResultT<F>> handle(block);
+  this->SubmitPinned(queue, block);
+  return handle;
+}
+
+template <typename Rep, typename Period, typename F>
+TaskHandle<TaskResultT<F>>
+Executor::ScheduleAfter(chrono::duration<Rep, Period> const &delay,
+                        F &&target, TaskOptions const &options) {
+  return this->ScheduleAt(Now() + DurationCast<SteadyClock::duration>(delay),
+                          std::forward<F>(target), options);
+}
+
+inline ScheduleAwaiter Executor::Schedule() { return ScheduleAwaiter(*this); }
+
+template <typename F>
+TaskHandle<TaskResultT<F>>
+Executor::Schedule(F &&target, Vec<Handle> const &dependencies,
+                   TaskOptions const &options) {
+  TaskBlock *block = TaskBlock::Acquire();
+  block->Emplace(std::forward<F>(target));
+  block->SetOptions(options);
+  block->AttachToken();
+  TaskHandle<TaskResultT<F>> handle(block);
+  this->SubmitAfter(block, dependencies);
+  return handle;
+}
+
+template <typename T>
+void Executor::WaitUntil(Atomic<T> const &value, T const &target) {
+  while (true) {
+    T current = value.load();
+    if (current == target) {
+      return;
+    }
+    if (!this->TryRunOne() &&
+        (mReplayMode.load(std::memory_order_relaxed) != ReplayMode::Replay ||
+         !this->ResolveReplayStall())) {
+      this->ParkWaiter([&value, &current]() { return value.load() != current; });
+    }
+  }
+}
+
+template <typename F> void Executor::ParkWaiter(F const &isDone) {
+  Uint epoch = mWaitEpoch.load();
+  mNumParkedWaiters.fetch_add(1);
+  // Pairs with the fence in Wake() and the decrement in Execute(): either
+  // the producer sees this waiter or the checks below see its work.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!isDone() && !this->HasWork() &&
+      (mPinnedQueues.empty() || !this->HasPinnedWork())) {
+    mWaitEpoch.wait(epoch);
+  }
+  mNumParkedWaiters.fetch_sub(1);
+}
+} // namespace TerreateCore::Utils
+
 #endif // __TERREATECORE_EXECUTOR_HPP__
@@ -0,0 +1,320 @@
+#ifndef __TERREATECORE_LOCKFREE_HPP__
+#define __TERREATECORE_LOCKFREE_HPP__
+
+#include <algorithm>
+#include <new>
+
+#include "defines.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+/*
+ * @brief: Chase-Lev work-stealing deque (Le et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models", PPoPP 2013).
+ * The owner thread pushes and pops at the bottom, any other thread may steal
+ * from the top. T must be trivially copyable (typically a pointer).
+ */
+template <typename T> class WorkStealingDeque {
+private:
+  static_assert(std::is_trivially_copyable_v<T>,
+                "WorkStealingDeque requires a trivially copyable type.");
+
+  struct Buffer {
+    Long capacity;
+    Long mask;
+    UniquePtr<Atomic<T>[]> data;
+
+    explicit Buffer(Long const &cap)
+        : capacity(cap), mask(cap - 1), data(new Atomic<T>[cap]) {}
+
+    T Get(Long const &index) const {
+      return data[index & mask].load(std::memory_order_relaxed);
+    }
+    void Put(Long const &index, T const &item) {
+      data[index & mask].store(item, std::memory_order_relaxed);
+    }
+    Buffer *Grow(Long const &bottom, Long const &top,
+                 Long const &newCapacity) const {
+      Buffer *buffer = new Buffer(newCapacity);
+      for (Long i = top; i < bottom; ++i) {
+        buffer->Put(i, this->Get(i));
+      }
+      return buffer;
+    }
+  };
+
+private:
+  alignas(64) Atomic<Long> mTop = 0;
+  alignas(64) Atomic<Long> mBottom = 0;
+  Atomic<Buffer *> mBuffer;
+  // Buffers replaced by Grow() may still be read by a concurrent thief, so
+  // they are kept alive until the deque itself is destroyed.
+  Vec<UniquePtr<Buffer>> mRetired;
+
+public:
+  explicit WorkStealingDeque(Long const &capacity = 256)
+      : mBuffer(new Buffer(capacity)) {}
+  ~WorkStealingDeque() { delete mBuffer.load(std::memory_order_relaxed); }
+
+  WorkStealingDeque(WorkStealingDeque const &) = delete;
+  WorkStealingDeque &operator=(WorkStealingDeque const &) = delete;
+
+  Bool Empty() const {
+    Long bottom = mBottom.load(std::memory_order_relaxed);
+    Long top = mTop.load(std::memory_order_relaxed);
+    return bottom <= top;
+  }
+  Size Count() const {
+    Long bottom = mBottom.load(std::memory_order_relaxed);
+    Long top = mTop.load(std::memory_order_relaxed);
+    return bottom > top ? static_cast<Size>(bottom - top) : 0u;
+  }
+
+  /*
+   * @brief: Push an item to the bottom. Owner thread only.
+   * @param: item: Item to be pushed
+   */
+  void Push(T const &item) {
+    Long bottom = mBottom.load(std::memory_order_relaxed);
+    Long top = mTop.load(std::memory_order_acquire);
+    Buffer *buffer = mBuffer.load(std::memory_order_relaxed);
+    if (bottom - top > buffer->capacity - 1) {
+      mRetired.emplace_back(buffer);
+      buffer = buffer->Grow(bottom, top, buffer->capacity * 2);
+      mBuffer.store(buffer, std::memory_order_release);
+    }
+    buffer->Put(bottom, item);
+    mBottom.store(bottom + 1, std::memory_order_release);
+  }
+  /*
+   * @brief: Push several items to the bottom and publish them together.
+   * Owner thread only.
+   * @param: items: Items to be pushed
+   * @param: count: Number of items
+   */
+  void PushBatch(T const *items, Size const &count) {
+    Long bottom = mBottom.load(std::memory_order_relaxed);
+    Long top = mTop.load(std::memory_order_acquire);
+    Buffer *buffer = mBuffer.load(std::memory_order_relaxed);
+    Long required = bottom - top + static_cast<Long>(count);
+    if (required > buffer->capacity - 1) {
+      Long capacity = buffer->capacity * 2;
+      while (required > capacity - 1) {
+        capacity *= 2;
+      }
+      mRetired.emplace_back(buffer);
+      buffer = buffer->Grow(bottom, top, capacity);
+      mBuffer.store(buffer, std::memory_order_release);
+    }
+    for (Size i = 0; i < count; ++i) {
+      buffer->Put(bottom + static_cast<Long>(i), items[i]);
+    }
+    mBottom.store(bottom + static_cast<Long>(count), std::memory_order_release);
+  }
+  /*
+   * @brief: Pop an item from the bottom. Owner thread only.
+   * @param: item: Receives the popped item
+   * @return: Whether an item was popped
+   */
+  Bool Pop(T &item) {
+    Long bottom = mBottom.load(std::memory_order_relaxed) - 1;
+    Buffer *buffer = mBuffer.load(std::memory_order_relaxed);
+    mBottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Long top = mTop.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+      mBottom.store(bottom + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    item = buffer->Get(bottom);
+    if (top == bottom) {
+      Bool won = mTop.compare_exchange_strong(top, top + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed);
+      mBottom.store(bottom + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+  /*
+   * @brief: Steal an item from the top. Any thread.
+   * @param: item: Receives the stolen item
+   * @return: Whether an item was stolen
+   */
+  Bool Steal(T &item) {
+    Long top = mTop.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Long bottom = mBottom.load(std::memory_order_acquire);
+
+    if (top >= bottom) {
+      return false;
+    }
+
+    Buffer *buffer = mBuffer.load(std::memory_order_acquire);
+    item = buffer->Get(top);
+    return mTop.compare_exchange_strong(top, top + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed);
+  }
+};
+
+/*
+ * @brief: Bounded multi-producer/multi-consumer queue (D. Vyukov's
+ * sequence-numbered ring buffer). Push and pop are lock-free and each touches
+ * a single shared index with one CAS. The capacity is rounded up to a power
+ * of two.
+ */
+template <typename T> class MPMCQueue {
+private:
+  struct Cell {
+    Atomic<Size> sequence;
+    alignas(T) Ubyte storage[sizeof(T)];
+
+    T *Get() { return std::launder(reinterpret_cast<T *>(storage)); }
+  };
+
+private:
+  UniquePtr<Cell[]> mCells;
+  Size mMask;
+  alignas(64) Atomic<Size> mEnqueuePos = 0u;
+  alignas(64) Atomic<Size> mDequeuePos = 0u;
+
+public:
+  explicit MPMCQueue(Size const &capacity) {
+    Size size = 2u;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mCells.reset(new Cell[size]);
+    mMask = size - 1;
+    for (Size i = 0; i < size; ++i) {
+      mCells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  ~MPMCQueue() {
+    T item;
+    while (this->TryPop(item)) {
+    }
+  }
+
+  MPMCQueue(MPMCQueue const &) = delete;
+  MPMCQueue &operator=(MPMCQueue const &) = delete;
+
+  Size Capacity() const { return mMask + 1; }
+  Bool Empty() const {
+    return mDequeuePos.load(std::memory_order_relaxed) >=
+           mEnqueuePos.load(std::memory_order_relaxed);
+  }
+
+  /*
+   * @brief: Push an item. The item is left untouched when the queue is full.
+   * @param: item: Item to be pushed
+   * @return: Whether the item was pushed
+   */
+  Bool TryPush(T &&item) {
+    Cell *cell = nullptr;
+    Size pos = mEnqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &mCells[pos & mMask];
+      Size sequence = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::intptr_t>(sequence) -
+                  static_cast<std::intptr_t>(pos);
+      if (diff == 0) {
+        if (mEnqueuePos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = mEnqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+
+    new (cell->storage) T(std::move(item));
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+  /*
+   * @brief: Push up to `count` items, claiming their cells with one CAS.
+   * Items past the free space are left untouched.
+   * @param: items: Items to be pushed
+   * @param: count: Number of items
+   * @return: Number of items pushed, from the front of `items`
+   */
+  Size TryPushBatch(T *items, Size const &count) {
+    Size pos = mEnqueuePos.load(std::memory_order_relaxed);
+    Size numClaimed = 0u;
+    while (true) {
+      Size sequence =
+          mCells[pos & mMask].sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::intptr_t>(sequence) -
+                  static_cast<std::intptr_t>(pos);
+      if (diff < 0) {
+        return 0u;
+      } else if (diff > 0) {
+        pos = mEnqueuePos.load(std::memory_order_relaxed);
+        continue;
+      }
+
+      // Consumers may still be finishing with some of the later cells, but
+      // every claimed position has been dequeued.
+      Size dequeued = mDequeuePos.load(std::memory_order_relaxed);
+      Size used = pos - std::min(pos, dequeued);
+      numClaimed = std::min(count, this->Capacity() - used);
+      if (numClaimed == 0) {
+        return 0u;
+      }
+      if (mEnqueuePos.compare_exchange_weak(pos, pos + numClaimed,
+                                            std::memory_order_relaxed)) {
+        break;
+      }
+    }
+
+    for (Size i = 0; i < numClaimed; ++i) {
+      Cell *cell = &mCells[(pos + i) & mMask];
+      while (cell->sequence.load(std::memory_order_acquire) != pos + i) {
+        std::this_thread::yield();
+      }
+      new (cell->storage) T(std::move(items[i]));
+      cell->sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    return numClaimed;
+  }
+  /*
+   * @brief: Pop an item.
+   * @param: item: Receives the popped item
+   * @return: Whether an item was popped
+   */
+  Bool TryPop(T &item) {
+    Cell *cell = nullptr;
+    Size pos = mDequeuePos.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &mCells[pos & mMask];
+      Size sequence = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::intptr_t>(sequence) -
+                  static_cast<std::intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (mDequeuePos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = mDequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+
+    item = std::move(*cell->Get());
+    cell->Get()->~T();
+    cell->sequence.store(pos + mMask + 1, std::memory_order_release);
+    return true;
+  }
+};
+} // namespace TerreateCore::Utils
+
+#endif // __TERREATECORE_LOCKFREE_HPP__
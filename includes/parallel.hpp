@@ -0,0 +1,189 @@
+#ifndef __TERREATECORE_PARALLEL_HPP__
+#define __TERREATECORE_PARALLEL_HPP__
+
+#include <algorithm>
+#include <iterator>
+
+#include "defines.hpp"
+#include "executor.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+/*
+ * @brief: Run body(chunk, begin, end) over grain-sized chunks of a range.
+ * The calling thread and at most one helper task per worker claim chunks
+ * from a shared counter, so the task count follows the worker count rather
+ * than the range size. The first exception thrown by body stops the loop and
+ * is rethrown once every helper has finished.
+ * @param: executor: Executor providing the helper tasks
+ * @param: range: Half-open index range
+ * @param: grain: Chunk size; 0 picks about eight chunks per thread
+ * @param: body: Callable taking (Size chunk, Size begin, Size end)
+ * @return: Number of chunks the range was cut into
+ */
+template <typename Body>
+Size ParallelChunks(Executor &executor, Pair<Size> const &range,
+                    Size const &grain, Body &&body);
+
+/*
+ * @brief: Call fn(i) for every i in the range.
+ * @param: executor: Executor providing the helper tasks
+ * @param: range: Half-open index range
+ * @param: grain: Chunk size; 0 picks one automatically
+ * @param: fn: Callable taking (Size i)
+ */
+template <typename F>
+void ParallelFor(Executor &executor, Pair<Size> const &range,
+                 Size const &grain, F &&fn);
+
+/*
+ * @brief: Map every index and combine the results. Partial results are
+ * combined in chunk order, so the result does not depend on scheduling.
+ * @param: executor: Executor providing the helper tasks
+ * @param: range: Half-open index range
+ * @param: grain: Chunk size; 0 picks one automatically
+ * @param: identity: Identity element of reduce
+ * @param: map: Callable taking (Size i) and returning T
+ * @param: reduce: Associative callable taking (T, T) and returning T
+ * @return: The combined result
+ */
+template <typename T, typename M, typename R>
+T ParallelReduce(Executor &executor, Pair<Size> const &range,
+                 Size const &grain, T const &identity, M &&map, R &&reduce);
+
+/*
+ * @brief: Write fn(*it) for every element of [first, last) to out.
+ * @param: executor: Executor providing the helper tasks
+ * @param: first: Beginning of the input range (random access)
+ * @param: last: End of the input range
+ * @param: out: Beginning of the output range (random access)
+ * @param: fn: Unary callable
+ * @param: grain: Chunk size; 0 picks one automatically
+ */
+template <typename InputIt, typename OutputIt, typename F>
+void ParallelTransform(Executor &executor, InputIt first, InputIt last,
+                       OutputIt out, F &&fn, Size const &grain = 0u);
+} // namespace TerreateCore::Utils
+
+// Implementation
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+template <typename Body>
+Size ParallelChunks(Executor &executor, Pair<Size> const &range,
+                    Size const &grain, Body &&body) {
+  if (range.second <= range.first) {
+    return 0u;
+  }
+
+  Size count = range.second - range.first;
+  Size numThreads = executor.GetNumWorkers() + 1u;
+  Size chunkSize = grain;
+  if (chunkSize == 0) {
+    chunkSize = std::max<Size>(1u, count / (numThreads * 8u));
+  }
+  Size numChunks = (count + chunkSize - 1) / chunkSize;
+
+  if (numChunks == 1) {
+    body(Size(0), range.first, range.second);
+    return numChunks;
+  }
+
+  Atomic<Size> next = 0u;
+  Atomic<Bool> failed = false;
+  ExceptionPtr error;
+  auto run = [&]() {
+    while (!failed.load(std::memory_order_relaxed)) {
+      Size chunk = next.fetch_add(1, std::memory_order_relaxed);
+      if (chunk >= numChunks) {
+        return;
+      }
+      Size begin = range.first + chunk * chunkSize;
+      Size end = std::min(begin + chunkSize, range.second);
+      try {
+        body(chunk, begin, end);
+      } catch (...) {
+        if (!failed.exchange(true)) {
+          error = std::current_exception();
+        }
+      }
+    }
+  };
+
+  Size numHelpers = std::min<Size>(numChunks - 1, executor.GetNumWorkers());
+  Vec<Handle> helpers;
+  helpers.reserve(numHelpers);
+  for (Size i = 0; i < numHelpers; ++i) {
+    helpers.push_back(executor.Schedule([&run]() { run(); }));
+  }
+  run();
+  // Helpers reference this stack frame, so every one of them has to finish
+  // before returning, even on failure.
+  for (auto const &helper : helpers) {
+    executor.Wait(helper);
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return numChunks;
+}
+
+template <typename F>
+void ParallelFor(Executor &executor, Pair<Size> const &range,
+                 Size const &grain, F &&fn) {
+  ParallelChunks(executor, range, grain,
+                 [&fn](Size const &, Size const &begin, Size const &end) {
+                   for (Size i = begin; i < end; ++i) {
+                     fn(i);
+                   }
+                 });
+}
+
+template <typename T, typename M, typename R>
+T ParallelReduce(Executor &executor, Pair<Size> const &range,
+                 Size const &grain, T const &identity, M &&map, R &&reduce) {
+  if (range.second <= range.first) {
+    return identity;
+  }
+
+  Size count = range.second - range.first;
+  Size chunkSize = grain;
+  if (chunkSize == 0) {
+    chunkSize = std::max<Size>(
+        1u, count / ((executor.GetNumWorkers() + 1u) * 8u));
+  }
+  Vec<T> partials((count + chunkSize - 1) / chunkSize, identity);
+
+  ParallelChunks(
+      executor, range, chunkSize,
+      [&](Size const &chunk, Size const &begin, Size const &end) {
+        T partial = identity;
+        for (Size i = begin; i < end; ++i) {
+          partial = reduce(std::move(partial), map(i));
+        }
+        partials[chunk] = std::move(partial);
+      });
+
+  T result = identity;
+  for (auto &partial : partials) {
+    result = reduce(std::move(result), std::move(partial));
+  }
+  return result;
+}
+
+template <typename InputIt, typename OutputIt, typename F>
+void ParallelTransform(Executor &executor, InputIt first, InputIt last,
+                       OutputIt out, F &&fn, Size const &grain) {
+  Size count = static_cast<Size>(std::distance(first, last));
+  ParallelChunks(executor, {0u, count}, grain,
+                 [&](Size const &, Size const &begin, Size const &end) {
+                   for (Size i = begin; i < end; ++i) {
+                     out[i] = fn(first[i]);
+                   }
+                 });
+}
+} // namespace TerreateCore::Utils
+
+#endif // __TERREATECORE_PARALLEL_HPP__
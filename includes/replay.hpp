@@ -0,0 +1,62 @@
+#ifndef __TERREATECORE_REPLAY_HPP__
+#define __TERREATECORE_REPLAY_HPP__
+
+#include "defines.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+/*
+ * @brief: One labelled task as it started during recording.
+ */
+struct ReplayEntry {
+  static constexpr Uint sNoWorker = ~0u;
+
+  // Index into ReplayLog::labels.
+  Uint label = 0u;
+  // How many tasks with the same label were queued before this one.
+  Uint occurrence = 0u;
+  // Worker that ran the task, or sNoWorker for a waiting thread.
+  Uint worker = sNoWorker;
+};
+
+/*
+ * @brief: Start order and worker of every labelled task of a recorded run.
+ * The binary form is a label table followed by one varint triple per task:
+ * label, occurrence relative to the label's previous entry, and worker.
+ * With fewer than 128 labels and workers an in-order entry takes three bytes.
+ */
+struct ReplayLog {
+  Vec<Str> labels;
+  Vec<ReplayEntry> entries;
+
+  /*
+   * @brief: Serialize the log.
+   * @return: Binary log
+   */
+  Vec<Ubyte> Encode() const;
+  /*
+   * @brief: Parse a binary log.
+   * @param: data: Output of Encode()
+   * @return: The log
+   * @throw: ExecutorError if the data is not a valid log
+   */
+  static ReplayLog Decode(Vec<Ubyte> const &data);
+
+  /*
+   * @brief: Write the encoded log to a file.
+   * @param: path: Output path
+   * @return: Whether the file was written
+   */
+  Bool Save(Str const &path) const;
+  /*
+   * @brief: Read a log written by Save().
+   * @param: path: Input path
+   * @return: The log
+   * @throw: ExecutorError if the file cannot be read or is not a valid log
+   */
+  static ReplayLog Load(Str const &path);
+};
+} // namespace TerreateCore::Utils
+
+#endif // __TERREATECORE_REPLAY_HPP__
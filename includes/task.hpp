@@ -0,0 +1,435 @@
+#ifndef __TERREATECORE_TASK_HPP__
+#define __TERREATECORE_TASK_HPP__
+
+#include <cstddef>
+#include <new>
+
+#include "defines.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+class Executor;
+class TaskBlock;
+
+/*
+ * @brief: State shared by a CancellationSource and its tokens. Tasks
+ * scheduled with a token stay linked here until they run, so cancelling can
+ * reach the ones that are still queued.
+ */
+struct CancellationState {
+  Atomic<Bool> cancelled = false;
+  Mutex mutex;
+  TaskBlock *head = nullptr;
+};
+
+/*
+ * @brief: Read side of a cancellation. Pass it to Schedule through
+ * TaskOptions and poll it from long-running tasks.
+ */
+class CancellationToken {
+private:
+  SharedPtr<CancellationState> mState;
+
+  friend class CancellationSource;
+  friend class TaskBlock;
+
+public:
+  CancellationToken() = default;
+
+  Bool Valid() const { return mState != nullptr; }
+  Bool IsCancelled() const {
+    return mState && mState->cancelled.load(std::memory_order_acquire);
+  }
+  /*
+   * @brief: Throw TaskCancelled if cancellation was requested.
+   */
+  void ThrowIfCancelled() const;
+};
+
+/*
+ * @brief: Owner side of a cancellation.
+ */
+class CancellationSource {
+private:
+  SharedPtr<CancellationState> mState;
+
+public:
+  CancellationSource() : mState(std::make_shared<CancellationState>()) {}
+
+  CancellationToken GetToken() const {
+    CancellationToken token;
+    token.mState = mState;
+    return token;
+  }
+  Bool IsCancelled() const { return mState->cancelled.load(); }
+  /*
+   * @brief: Cancel every task scheduled with a token of this source. Tasks
+   * that have not started are dropped: their callables are destroyed right
+   * away and their handles report TaskCancelled. Running tasks keep running
+   * and can poll their token. Tasks scheduled afterwards are dropped too.
+   * @return: Number of tasks dropped
+   */
+  Size Cancel();
+};
+
+enum class TaskPriority : Ubyte {
+  // Frame-critical work. Always taken before the other lanes.
+  Critical,
+  Normal,
+  // Bulk work such as asset decoding. Still gets a share of the workers
+  // while normal work is pending, so it cannot starve.
+  Background
+};
+
+/*
+ * @brief: Scheduling options of a single task.
+ */
+struct TaskOptions {
+  TaskPriority priority = TaskPriority::Normal;
+  // Tasks with a deadline run ahead of the rest of their lane, earliest
+  // deadline first. They never preempt a higher lane.
+  // The default value means no deadline.
+  SteadyTimePoint deadline = SteadyTimePoint();
+  CancellationToken token = {};
+  // Name shown in traces. Must outlive the task, e.g. a string literal.
+  char const *label = nullptr;
+
+  Bool HasDeadline() const { return deadline != SteadyTimePoint(); }
+};
+
+/*
+ * @brief: Control block of a scheduled task. Blocks are recycled through a
+ * pool and keep the callable inline when it fits, so scheduling a small
+ * lambda does not allocate.
+ */
+class alignas(64) TaskBlock {
+public:
+  static constexpr Size sInlineSize = 64;
+
+  // Done and Cancelled are both final.
+  enum class State : Uint { Pending, Running, Done, Cancelled };
+
+private:
+  // Holds the callable until it has run, then the result if it fits.
+  alignas(std::max_align_t) Ubyte mStorage[sInlineSize];
+  void *mCallable = nullptr;
+  void (*mInvoke)(TaskBlock *) = nullptr;
+  void (*mDestroy)(void *) = nullptr;
+  void *mResult = nullptr;
+  void (*mDestroyResult)(void *) = nullptr;
+
+  Atomic<Uint> mRefCount = 0u;
+  Atomic<State> mState = State::Pending;
+  ExceptionPtr mException;
+
+  // Task graph. A block becomes runnable once mPendingDependencies drops to
+  // zero. mSuccessors keeps its capacity across recycling.
+  Executor *mExecutor = nullptr;
+  Atomic<Uint> mPendingDependencies = 0u;
+  Vec<TaskBlock *> mSuccessors;
+  std::atomic_flag mSuccessorLock = ATOMIC_FLAG_INIT;
+
+  TaskOptions mOptions;
+  SteadyTimePoint mQueuedAt = SteadyTimePoint();
+  Ulong mTracedAt = 0u;
+  Ulong mReplayKey = 0u;
+  // Links in the token's list of unstarted tasks.
+  TaskBlock *mTokenPrev = nullptr;
+  TaskBlock *mTokenNext = nullptr;
+  Bool mTokenLinked = false;
+  // Timer wheel links; mTimerSlot is set while the block waits in a wheel.
+  TaskBlock **mTimerSlot = nullptr;
+  TaskBlock *mTimerPrev = nullptr;
+  TaskBlock *mTimerNext = nullptr;
+  Ulong mTimerTick = 0u;
+
+  TaskBlock *mNext = nullptr;
+
+private:
+  template <typename F> static void InvokeCallable(TaskBlock *block);
+  template <typename F> static void DestroyInline(void *callable) {
+    static_cast<F *>(callable)->~F();
+  }
+  template <typename F> static void DestroyHeap(void *callable) {
+    delete static_cast<F *>(callable);
+  }
+
+  template <typename R> void StoreResult(R &&result);
+  void Recycle();
+  void Finish(State const &state);
+  void UnlinkToken();
+  void LockSuccessors() {
+    while (mSuccessorLock.test_and_set(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+  void UnlockSuccessors() {
+    mSuccessorLock.clear(std::memory_order_release);
+  }
+
+  friend class TaskBlockPool;
+  friend class CancellationSource;
+  friend class TimerWheel;
+
+public:
+  /*
+   * @brief: Take a block from the pool. The caller owns one reference.
+   */
+  static TaskBlock *Acquire();
+  /*
+   * @brief: Number of blocks the pool has allocated so far.
+   */
+  static Size GetNumAllocated();
+
+  template <typename F> void Emplace(F &&callable);
+
+  // Intrusive link used by the pool and by pinned queues.
+  TaskBlock *GetNext() const { return mNext; }
+  void SetNext(TaskBlock *next) { mNext = next; }
+
+  Executor *GetExecutor() const { return mExecutor; }
+  void SetExecutor(Executor *executor) { mExecutor = executor; }
+  TaskOptions const &GetOptions() const { return mOptions; }
+  void SetOptions(TaskOptions const &options) { mOptions = options; }
+  SteadyTimePoint const &GetQueuedAt() const { return mQueuedAt; }
+  void SetQueuedAt(SteadyTimePoint const &queuedAt) { mQueuedAt = queuedAt; }
+  // TaskTracer timestamp taken when the task was queued, or 0.
+  Ulong const &GetTracedAt() const { return mTracedAt; }
+  void SetTracedAt(Ulong const &tracedAt) { mTracedAt = tracedAt; }
+  // Identity of a labelled task while recording or replaying, or 0.
+  Ulong const &GetReplayKey() const { return mReplayKey; }
+  void SetReplayKey(Ulong const &replayKey) { mReplayKey = replayKey; }
+
+  /*
+   * @brief: Register a task that must wait for this one.
+   * @param: successor: Task to be released when this one completes
+   * @return: False if this task is already done and nothing was registered
+   */
+  Bool AddSuccessor(TaskBlock *successor);
+  void AddDependency() {
+    mPendingDependencies.fetch_add(1, std::memory_order_relaxed);
+  }
+  /*
+   * @brief: Drop one unfinished dependency.
+   * @return: Whether this was the last one and the task is now runnable
+   */
+  Bool ReleaseDependency() {
+    return mPendingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+  /*
+   * @brief: Release every successor after this task is done.
+   * @param: onReady: Called with each successor that became runnable
+   */
+  template <typename F> void ReleaseSuccessors(F &&onReady);
+  /*
+   * @brief: Invoke and destroy the stored callable, then mark the block done.
+   * Exceptions are captured in the block instead of being propagated.
+   * @return: False if the task was cancelled and nothing was invoked
+   */
+  Bool Run();
+  /*
+   * @brief: Drop the task if it has not started yet, destroying its callable.
+   * @return: Whether the task was dropped
+   */
+  Bool Cancel();
+  /*
+   * @brief: Drop the task like Cancel(), but report an error of the caller's
+   * choosing instead of TaskCancelled.
+   * @param: error: Exception the handle rethrows
+   * @return: Whether the task was dropped
+   */
+  Bool Abort(ExceptionPtr const &error);
+  /*
+   * @brief: Link the task to its token so the source can reach it. A task
+   * whose token is already cancelled is dropped instead.
+   */
+  void AttachToken();
+  /*
+   * @brief: Unlink the task from its token once it no longer needs to be
+   * reached.
+   */
+  void DetachToken();
+
+  void AddRef() { mRefCount.fetch_add(1, std::memory_order_relaxed); }
+  void Release() {
+    if (mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      this->Recycle();
+    }
+  }
+
+  Bool Done() const {
+    return mState.load(std::memory_order_acquire) >= State::Done;
+  }
+  Bool Cancelled() const {
+    return mState.load(std::memory_order_acquire) == State::Cancelled;
+  }
+  void Wait() const {
+    State state = mState.load(std::memory_order_acquire);
+    while (state < State::Done) {
+      mState.wait(state, std::memory_order_acquire);
+      state = mState.load(std::memory_order_acquire);
+    }
+  }
+  ExceptionPtr const &GetException() const { return mException; }
+  template <typename R> R const &GetResult() const {
+    return *static_cast<R const *>(mResult);
+  }
+};
+
+/*
+ * @brief: Value type a callable's result is stored as.
+ */
+template <typename F>
+using TaskResultT = std::decay_t<std::invoke_result_t<std::decay_t<F> &>>;
+
+/*
+ * @brief: Shared reference to a scheduled task, used to wait for it and to
+ * retrieve its exception.
+ */
+class HandleBase {
+protected:
+  TaskBlock *mBlock = nullptr;
+
+  friend class Executor;
+
+protected:
+  void Rethrow() const {
+    if (mBlock && mBlock->GetException()) {
+      std::rethrow_exception(mBlock->GetException());
+    }
+  }
+
+public:
+  HandleBase() = default;
+  explicit HandleBase(TaskBlock *block) : mBlock(block) {
+    if (mBlock) {
+      mBlock->AddRef();
+    }
+  }
+  HandleBase(HandleBase const &other) : HandleBase(other.mBlock) {}
+  HandleBase(HandleBase &&other) noexcept : mBlock(other.mBlock) {
+    other.mBlock = nullptr;
+  }
+  ~HandleBase() {
+    if (mBlock) {
+      mBlock->Release();
+    }
+  }
+
+  Bool Valid() const { return mBlock != nullptr; }
+  Bool Done() const { return mBlock && mBlock->Done(); }
+  Bool Cancelled() const { return mBlock && mBlock->Cancelled(); }
+  void Wait() const {
+    if (mBlock) {
+      mBlock->Wait();
+    }
+  }
+
+  HandleBase &operator=(HandleBase const &other) {
+    HandleBase(other).Swap(*this);
+    return *this;
+  }
+  HandleBase &operator=(HandleBase &&other) noexcept {
+    HandleBase(std::move(other)).Swap(*this);
+    return *this;
+  }
+
+  void Swap(HandleBase &other) noexcept { std::swap(mBlock, other.mBlock); }
+};
+
+/*
+ * @brief: Handle to a task returning R. The result lives in the task's
+ * block, so reading it is an acquire load rather than a lock round-trip.
+ */
+template <typename R> class TaskHandle : public HandleBase {
+public:
+  using HandleBase::HandleBase;
+
+  /*
+   * @brief: Wait for the task and return its result.
+   * Rethrows the task's exception, if any. The reference stays valid while
+   * this handle is alive.
+   */
+  R const &Get() const {
+    this->Wait();
+    this->Rethrow();
+    return mBlock->GetResult<R>();
+  }
+};
+
+template <> class TaskHandle<void> : public HandleBase {
+public:
+  using HandleBase::HandleBase;
+  // Any typed handle can be used where only completion matters.
+  TaskHandle(HandleBase const &other) : HandleBase(other) {}
+  TaskHandle(HandleBase &&other) noexcept : HandleBase(std::move(other)) {}
+
+  /*
+   * @brief: Wait for the task and rethrow its exception, if any.
+   */
+  void Get() const {
+    this->Wait();
+    this->Rethrow();
+  }
+};
+
+typedef TaskHandle<void> Handle;
+} // namespace TerreateCore::Utils
+
+// Implementation
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+template <typename F> void TaskBlock::Emplace(F &&callable) {
+  using Callable = std::decay_t<F>;
+  if constexpr (sizeof(Callable) <= sInlineSize &&
+                alignof(Callable) <= alignof(std::max_align_t)) {
+    mCallable = new (mStorage) Callable(std::forward<F>(callable));
+    mDestroy = &TaskBlock::DestroyInline<Callable>;
+  } else {
+    mCallable = new Callable(std::forward<F>(callable));
+    mDestroy = &TaskBlock::DestroyHeap<Callable>;
+  }
+  mInvoke = &TaskBlock::InvokeCallable<Callable>;
+}
+
+template <typename F> void TaskBlock::InvokeCallable(TaskBlock *block) {
+  F &callable = *static_cast<F *>(block->mCallable);
+  using Result = TaskResultT<F>;
+  if constexpr (std::is_void_v<Result>) {
+    callable();
+  } else {
+    // The callable's storage is reused for the result, so it is destroyed
+    // before the result is moved in.
+    Result result = callable();
+    block->mDestroy(block->mCallable);
+    block->mCallable = nullptr;
+    block->StoreResult(std::move(result));
+  }
+}
+
+template <typename R> void TaskBlock::StoreResult(R &&result) {
+  using Result = std::decay_t<R>;
+  if constexpr (sizeof(Result) <= sInlineSize &&
+                alignof(Result) <= alignof(std::max_align_t)) {
+    mResult = new (mStorage) Result(std::forward<R>(result));
+    mDestroyResult = &TaskBlock::DestroyInline<Result>;
+  } else {
+    mResult = new Result(std::forward<R>(result));
+    mDestroyResult = &TaskBlock::DestroyHeap<Result>;
+  }
+}
+
+template <typename F> void TaskBlock::ReleaseSuccessors(F &&onReady) {
+  // Run() closed the list under the lock, so no successor can be added now.
+  for (TaskBlock *successor : mSuccessors) {
+    if (successor->ReleaseDependency()) {
+      onReady(successor);
+    }
+  }
+  mSuccessors.clear();
+}
+} // namespace TerreateCore::Utils
+
+#endif // __TERREATECORE_TASK_HPP__
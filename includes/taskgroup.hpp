@@ -0,0 +1,125 @@
+#ifndef __TERREATECORE_TASKGROUP_HPP__
+#define __TERREATECORE_TASKGROUP_HPP__
+
+#include "defines.hpp"
+#include "executor.hpp"
+#include "task.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+/*
+ * @brief: Scope owning a set of tasks on an Executor. The group tracks its
+ * tasks with one counter instead of a handle each, and Wait() runs queued
+ * work on the calling thread until the counter drops to zero. The first
+ * exception thrown by a task cancels the rest of the group and is rethrown
+ * from Wait(). A group left without Wait() cancels its remaining tasks and
+ * waits for the running ones, so tasks may safely reference the scope.
+ */
+class TaskGroup {
+private:
+  // Lives inside every spawned callable and counts the task as finished
+  // when the callable is destroyed, whether it ran or was cancelled.
+  class Ticket {
+  private:
+    TaskGroup *mGroup = nullptr;
+
+  public:
+    explicit Ticket(TaskGroup *group) : mGroup(group) {}
+    Ticket(Ticket const &) = delete;
+    Ticket(Ticket &&other) noexcept : mGroup(other.mGroup) {
+      other.mGroup = nullptr;
+    }
+    ~Ticket() {
+      if (mGroup) {
+        mGroup->Finish();
+      }
+    }
+
+    Ticket &operator=(Ticket const &) = delete;
+    Ticket &operator=(Ticket &&) = delete;
+
+    TaskGroup *GetGroup() const { return mGroup; }
+  };
+
+private:
+  Executor &mExecutor;
+  TaskOptions mOptions;
+  CancellationSource mSource;
+  Atomic<Size> mNumPending = 0u;
+  // A round runs from the counter leaving zero until it returns there. The
+  // task closing a round counts it after its notify, which is its final
+  // access to the group, so waiters know when the group may go away.
+  Atomic<Size> mNumRounds = 0u;
+  Atomic<Size> mNumSettledRounds = 0u;
+  Atomic<Bool> mFailed = false;
+  ExceptionPtr mError;
+  Bool mWaited = false;
+
+private:
+  void Finish();
+  void Fail(ExceptionPtr const &error);
+  void WaitSettled();
+
+public:
+  /*
+   * @brief: Create an empty group.
+   * @param: executor: Executor the group's tasks run on
+   * @param: options: Options for every spawned task; the group supplies the
+   * cancellation token
+   */
+  explicit TaskGroup(Executor &executor, TaskOptions const &options = {});
+  TaskGroup(TaskGroup const &) = delete;
+  ~TaskGroup();
+
+  Executor &GetExecutor() const { return mExecutor; }
+  Size GetNumPending() const { return mNumPending.load(); }
+  Bool IsCancelled() const { return mSource.IsCancelled(); }
+  // Token of the group, for long-running tasks to poll.
+  CancellationToken GetToken() const { return mSource.GetToken(); }
+
+  /*
+   * @brief: Schedule a task as part of the group. Tasks may spawn more tasks
+   * into the same group.
+   * @param: target: Callable to be run
+   */
+  template <typename F> void Spawn(F &&target);
+  /*
+   * @brief: Drop every task that has not started yet.
+   */
+  void Cancel() { mSource.Cancel(); }
+  /*
+   * @brief: Wait for every task of the group, running queued work on the
+   * calling thread meanwhile.
+   * @throw: The first exception thrown by a task of the group
+   */
+  void Wait();
+
+  TaskGroup &operator=(TaskGroup const &) = delete;
+};
+} // namespace TerreateCore::Utils
+
+// Implementation
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+template <typename F> void TaskGroup::Spawn(F &&target) {
+  if (mNumPending.fetch_add(1) == 0) {
+    mNumRounds.fetch_add(1, std::memory_order_relaxed);
+  }
+  mExecutor.Schedule(
+      [ticket = Ticket(this), target = std::forward<F>(target)]() mutable {
+        if (ticket.GetGroup()->IsCancelled()) {
+          return;
+        }
+        try {
+          target();
+        } catch (...) {
+          ticket.GetGroup()->Fail(std::current_exception());
+        }
+      },
+      mOptions);
+}
+} // namespace TerreateCore::Utils
+
+#endif // __TERREATECORE_TASKGROUP_HPP__
@@ -0,0 +1,52 @@
+#ifndef __TERREATECORE_THREAD_HPP__
+#define __TERREATECORE_THREAD_HPP__
+
+#include "defines.hpp"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+/*
+ * @brief: Tell the CPU the caller is busy-waiting, which frees pipeline
+ * resources for a sibling hyper-thread.
+ */
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(_M_X64) || defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * @brief: Online CPUs grouped by NUMA node, as listed under
+ * /sys/devices/system/node. Where that is unavailable every CPU is reported
+ * as part of a single node.
+ * @return: CPU ids of every node, in node order
+ */
+Vec<Vec<Uint>> GetNumaNodes();
+
+/*
+ * @brief: Restrict the calling thread to a set of CPUs. Does nothing on
+ * platforms without sched_setaffinity.
+ * @param: cpus: CPU ids the thread may run on
+ * @return: Whether the affinity was applied
+ */
+Bool SetThreadAffinity(Vec<Uint> const &cpus);
+
+/*
+ * @brief: Name the calling thread for debuggers and profilers. Linux keeps
+ * only the first 15 characters.
+ * @param: name: Thread name
+ * @return: Whether the name was applied
+ */
+Bool SetThreadName(Str const &name);
+} // namespace TerreateCore::Utils
+
+#endif // __TERREATECORE_THREAD_HPP__
@@ -0,0 +1,87 @@
+#ifndef __TERREATECORE_TIMER_HPP__
+#define __TERREATECORE_TIMER_HPP__
+
+#include "defines.hpp"
+#include "task.hpp"
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+/*
+ * @brief: Hierarchical timer wheel of task blocks. Four levels of 64 slots
+ * cover 64^4 ticks; a timer sits in the level matching how far away it is
+ * and moves down a level each time its slot comes round, so insert and
+ * remove are O(1) and advancing costs O(1) per tick plus one move per timer
+ * and level. Timers past the range wait in the last level and are re-placed
+ * when they come round. Not thread-safe.
+ */
+class TimerWheel {
+private:
+  static constexpr Uint sNumLevels = 4u;
+  static constexpr Uint sSlotBits = 6u;
+  static constexpr Uint sNumSlots = 1u << sSlotBits;
+  static constexpr Ulong sSlotMask = sNumSlots - 1u;
+  static constexpr Ulong sRange = 1ull << (sSlotBits * sNumLevels);
+
+private:
+  NanoSec mResolution;
+  SteadyTimePoint mOrigin;
+  Ulong mCurrent = 0u;
+  Size mCount = 0u;
+  TaskBlock *mSlots[sNumLevels][sNumSlots] = {};
+  Ulong mOccupied[sNumLevels] = {};
+
+private:
+  Ulong ToTick(SteadyTimePoint const &time, Bool const &roundUp) const;
+  SteadyTimePoint ToTime(Ulong const &tick) const {
+    return mOrigin + mResolution * static_cast<Long>(tick);
+  }
+  void Link(TaskBlock *block, Uint const &level, Uint const &slot);
+  void Unlink(TaskBlock *block);
+  void Place(TaskBlock *block);
+  TaskBlock *TakeSlot(Uint const &level, Uint const &slot);
+
+public:
+  /*
+   * @brief: Timers fire at the first tick at or after their time.
+   * @param: resolution: Length of one tick
+   */
+  explicit TimerWheel(NanoSec const &resolution = MilliSec(1));
+  TimerWheel(TimerWheel const &) = delete;
+  TimerWheel &operator=(TimerWheel const &) = delete;
+
+  Size GetCount() const { return mCount; }
+  NanoSec const &GetResolution() const { return mResolution; }
+
+  /*
+   * @brief: Add a timer for a block.
+   * @param: block: Block to be returned by Advance once due
+   * @param: time: When the block is due
+   * @return: False if the time has already passed and nothing was added
+   */
+  Bool Insert(TaskBlock *block, SteadyTimePoint const &time);
+  /*
+   * @brief: Remove a block's timer.
+   * @return: False if the block is not in this wheel
+   */
+  Bool Remove(TaskBlock *block);
+  /*
+   * @brief: Move time forward and collect the blocks that became due.
+   * @param: now: Current time
+   * @param: expired: Receives the due blocks
+   */
+  void Advance(SteadyTimePoint const &now, Vec<TaskBlock *> &expired);
+  /*
+   * @brief: Take every remaining block out of the wheel.
+   * @param: blocks: Receives the blocks
+   */
+  void Clear(Vec<TaskBlock *> &blocks);
+  /*
+   * @brief: Earliest time Advance may have something to do. Never later than
+   * the next timer; SteadyTimePoint::max() when the wheel is empty.
+   */
+  SteadyTimePoint GetNextExpiry() const;
+};
+} // namespace TerreateCore::Utils
+
+#endif // __TERREATECORE_TIMER_HPP__
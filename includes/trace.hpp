@@ -0,0 +1,163 @@
+#ifndef __TERREATECORE_TRACE_HPP__
+#define __TERREATECORE_TRACE_HPP__
+
+#include "defines.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+namespace TerreateCore::Utils {
+using namespace TerreateCore::Defines;
+
+/*
+ * @brief: One executed task. Times are TaskTracer::Timestamp() values when
+ * recorded and steady clock nanoseconds once collected.
+ */
+struct TraceEvent {
+  static constexpr Uint sNoWorker = ~0u;
+
+  // Label from TaskOptions; nullptr for unlabelled tasks.
+  char const *label = nullptr;
+  Long enqueued = 0;
+  Long started = 0;
+  Long finished = 0;
+  // Worker index, or sNoWorker when a waiting thread ran the task.
+  Uint worker = sNoWorker;
+  // Index of the recording thread's buffer.
+  Uint thread = 0u;
+};
+
+/*
+ * @brief: Process-wide recorder of executed tasks. Every thread appends to
+ * its own fixed-size ring buffer without locks or allocation, so recording
+ * costs a few stores; once a buffer wraps the oldest events are overwritten.
+ * A thread's buffer is handed to the next new thread when it exits, keeping
+ * its events, so memory follows the peak number of threads rather than the
+ * total. Events are stamped with the CPU cycle counter where there is one
+ * and converted to steady clock time when collected. A traced task costs
+ * three counter reads plus a few nanoseconds of bookkeeping, so the overhead
+ * is dominated by how fast the machine reads its cycle counter.
+ * The executor records into it only when built with
+ * TERREATECORE_EXECUTOR_TRACE, otherwise the recorder stays empty.
+ */
+class TaskTracer {
+private:
+  static constexpr Size sCapacity = 1u << 16;
+
+  struct Buffer {
+    Uint index = 0u;
+    Str name;
+    // Only the owning thread writes; readers acquire mHead before reading
+    // the events it covers.
+    Atomic<Size> head = 0u;
+    Atomic<Size> start = 0u;
+    UniquePtr<TraceEvent[]> events;
+    // Set once the owning thread has exited; guarded by mMutex.
+    Bool released = false;
+  };
+
+  // Gives the thread's buffer back when the thread exits.
+  struct ThreadLease {
+    ~ThreadLease();
+  };
+
+private:
+  static thread_local Buffer *sBuffer;
+
+private:
+  Atomic<Bool> mEnabled = true;
+  Long mOriginNanos = 0;
+  Ulong mOriginTicks = 0u;
+  Mutex mMutex;
+  Vec<UniquePtr<Buffer>> mBuffers;
+
+private:
+  TaskTracer();
+  Buffer *CreateBuffer();
+  void ReleaseBuffer(Buffer *buffer);
+  Double GetNanosPerTick() const;
+
+public:
+  // The tracer is never destroyed so worker threads can record until they
+  // exit.
+  static TaskTracer &Instance();
+
+  /*
+   * @brief: Whether the executor was built to record traces.
+   */
+  static constexpr Bool IsCompiled() {
+#ifdef TERREATECORE_EXECUTOR_TRACE
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /*
+   * @brief: Cheap timestamp for Record. Only differences between
+   * timestamps and their conversion by Collect are meaningful.
+   */
+  static Ulong Timestamp() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||             \
+    defined(_M_IX86)
+    return __rdtsc();
+#else
+    return static_cast<Ulong>(DurationCast<NanoSec>(SinceEpoch()).count());
+#endif
+  }
+
+  Bool IsEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+  void SetEnabled(Bool const &enabled) { mEnabled.store(enabled); }
+  // Number of ring buffers allocated so far.
+  Size GetNumBuffers();
+
+  /*
+   * @brief: Name the calling thread in exported traces.
+   * @param: name: Thread name
+   */
+  void SetThreadName(Str const &name);
+  /*
+   * @brief: Append an event to the calling thread's buffer.
+   * @param: event: Event with times taken from Timestamp(); its thread
+   * field is filled in
+   */
+  void Record(TraceEvent const &event) {
+    Buffer *buffer = sBuffer ? sBuffer : this->CreateBuffer();
+    Size head = buffer->head.load(std::memory_order_relaxed);
+    TraceEvent &slot = buffer->events[head & (sCapacity - 1)];
+    slot = event;
+    slot.thread = buffer->index;
+    buffer->head.store(head + 1, std::memory_order_release);
+  }
+
+  /*
+   * @brief: Copy out the recorded events, ordered by start time. Events
+   * recorded while this runs may be missing; collect after the executor is
+   * idle for a complete trace.
+   * @return: Recorded events
+   */
+  Vec<TraceEvent> Collect();
+  /*
+   * @brief: Forget every recorded event.
+   */
+  void Clear();
+
+  /*
+   * @brief: Export the recorded events in the Chrome trace-event format,
+   * which chrome://tracing and Perfetto both load.
+   * @return: JSON document
+   */
+  Str ToChromeTrace();
+  /*
+   * @brief: Write ToChromeTrace() to a file.
+   * @param: path: Output path
+   * @return: Whether the file was written
+   */
+  Bool WriteChromeTrace(Str const &path);
+};
+} // namespace TerreateCore::Utils
+
+#endif // __TERREATECORE_TRACE_HPP__
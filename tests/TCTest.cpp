@@ -1,6 +1,8 @@
 #include "../includes/TerreateCore.hpp"
 
 #include <iostream>
+#include <numeric>
+#include <span>
 
 using namespace TerreateCore;
 
@@ -69,7 +71,7 @@ void ExecutorTest() {
   std::cout << "Executor Test" << std::endl;
   std::cout << "-------------" << std::endl;
 
-  Defines::Vec<Utils::SharedFuture<void>> futures;
+  Defines::Vec<Utils::Handle> futures;
   for (int i = 0; i < 4; ++i) {
     futures.push_back(executor.Schedule([]() {
       std::this_thread::sleep_for(std::chrono::seconds(1));
@@ -83,6 +85,42 @@ void ExecutorTest() {
   executor.Schedule([]() { std::cout << "Task 3" << std::endl; }, futures);
 
   executor.WaitForAll();
+
+  // The only worker is stuck in the parent until its children are done, and
+  // they are queued after the waiter has parked, so only the waiter can run
+  // them.
+  Utils::Executor single(1);
+  std::thread::id waiter = std::this_thread::get_id();
+  for (int round = 0; round < 2; ++round) {
+    Defines::Atomic<int> numByWaiter = 0;
+    Defines::Atomic<int> numDone = 0;
+    Defines::Atomic<Defines::Bool> started = false;
+    Utils::Handle parent = single.Schedule([&]() {
+      started.store(true);
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      for (int i = 0; i < 8; ++i) {
+        single.Schedule([&]() {
+          if (std::this_thread::get_id() == waiter) {
+            numByWaiter.fetch_add(1);
+          }
+          numDone.fetch_add(1);
+        });
+      }
+      while (numDone.load() != 8) {
+        std::this_thread::yield();
+      }
+    });
+    while (!started.load()) {
+      std::this_thread::yield();
+    }
+    if (round == 0) {
+      single.Wait(parent);
+    } else {
+      single.WaitForAll();
+    }
+    std::cout << (round == 0 ? "Wait" : "WaitForAll")
+              << " ran late children: " << numByWaiter.load() << std::endl;
+  }
 }
 
 void ExecutorErrorTest() {
@@ -104,24 +142,1203 @@ void ExecutorErrorTest() {
   }
 }
 
+void ExecutorWorkStealingTest() {
+  Utils::Executor executor(4, Utils::SchedulingMode::WorkStealing);
+
+  std::cout << "Executor Work-Stealing Test" << std::endl;
+  std::cout << "---------------------------" << std::endl;
+
+  Defines::Atomic<int> counter = 0;
+  for (int i = 0; i < 16; ++i) {
+    executor.Schedule([&executor, &counter]() {
+      for (int j = 0; j < 64; ++j) {
+        executor.Schedule([&counter]() { counter.fetch_add(1); });
+      }
+      counter.fetch_add(1);
+    });
+  }
+
+  while (counter.load() != 16 * 65) {
+    std::this_thread::yield();
+  }
+  std::cout << "Tasks run: " << counter.load() << std::endl;
+}
+
+void ExecutorMemoryTest() {
+  Utils::Executor executor(4);
+
+  std::cout << "Executor Memory Test" << std::endl;
+  std::cout << "--------------------" << std::endl;
+
+  for (int round = 0; round < 100; ++round) {
+    for (int i = 0; i < 10000; ++i) {
+      executor.Schedule([i]() {
+        if (i % 1000 == 0) {
+          throw std::runtime_error("Task " + std::to_string(i));
+        }
+      });
+    }
+    executor.WaitForAll();
+  }
+
+  std::cout << "Blocks allocated: " << Utils::TaskBlock::GetNumAllocated()
+            << std::endl;
+  std::cout << "Exceptions kept: " << executor.GetExceptions().size()
+            << std::endl;
+  std::cout << "Exceptions dropped: " << executor.GetNumDroppedExceptions()
+            << std::endl;
+}
+
+void ExecutorGraphTest() {
+  std::cout << "Executor Graph Test" << std::endl;
+  std::cout << "-------------------" << std::endl;
+
+  int const numNodes = 100000;
+  for (auto mode : {Utils::SchedulingMode::SingleQueue,
+                    Utils::SchedulingMode::WorkStealing}) {
+    Utils::Executor executor(2, mode);
+
+    // A single chain would park every worker if dependencies blocked.
+    Defines::Atomic<int> last = -1;
+    Defines::Atomic<int> chainErrors = 0;
+    Utils::Handle previous;
+    for (int i = 0; i < numNodes; ++i) {
+      auto node = [i, &last, &chainErrors]() {
+        if (last.exchange(i) != i - 1) {
+          chainErrors.fetch_add(1);
+        }
+      };
+      if (previous.Valid()) {
+        previous = executor.Schedule(node, {previous});
+      } else {
+        previous = executor.Schedule(node);
+      }
+    }
+    executor.Wait(previous);
+
+    // A random DAG where every node checks that its predecessors ran first.
+    std::mt19937 random(42);
+    Defines::Vec<Defines::Atomic<Defines::Bool>> finished(numNodes);
+    Defines::Vec<Utils::Handle> handles(numNodes);
+    Defines::Atomic<int> dagErrors = 0;
+    for (int i = 0; i < numNodes; ++i) {
+      Defines::Vec<int> predecessors;
+      for (int j = 0; j < 4 && i > 0; ++j) {
+        int window = std::min(i, 64);
+        predecessors.push_back(i - 1 - static_cast<int>(random() % window));
+      }
+      Defines::Vec<Utils::Handle> dependencies;
+      for (int predecessor : predecessors) {
+        dependencies.push_back(handles[predecessor]);
+      }
+      handles[i] = executor.Schedule(
+          [i, predecessors, &finished, &dagErrors]() {
+            for (int predecessor : predecessors) {
+              if (!finished[predecessor].load()) {
+                dagErrors.fetch_add(1);
+              }
+            }
+            finished[i].store(true);
+          },
+          dependencies);
+    }
+    for (auto &handle : handles) {
+      handle.Wait();
+    }
+
+    std::cout << (mode == Utils::SchedulingMode::WorkStealing
+                      ? "[work-stealing] "
+                      : "[single-queue] ")
+              << "chain errors: " << chainErrors.load()
+              << ", DAG errors: " << dagErrors.load() << std::endl;
+  }
+}
+
+void ParallelTest() {
+  Utils::Executor executor(4, Utils::SchedulingMode::WorkStealing);
+
+  std::cout << "Parallel Test" << std::endl;
+  std::cout << "-------------" << std::endl;
+
+  Defines::Vec<int> values(100000, 0);
+  Utils::ParallelFor(executor, {0u, values.size()}, 0u,
+                     [&values](Defines::Size i) { values[i] = int(i % 7); });
+
+  Defines::Size sum = Utils::ParallelReduce(
+      executor, {0u, values.size()}, 1000u, Defines::Size(0),
+      [&values](Defines::Size i) { return Defines::Size(values[i]); },
+      [](Defines::Size a, Defines::Size b) { return a + b; });
+  std::cout << "Sum: " << sum << std::endl;
+
+  Defines::Vec<int> doubled(values.size());
+  Utils::ParallelTransform(executor, values.begin(), values.end(),
+                           doubled.begin(), [](int v) { return v * 2; });
+  std::cout << "Doubled[13]: " << doubled[13] << std::endl;
+
+  try {
+    Utils::ParallelFor(executor, {0u, 1000u}, 10u, [](Defines::Size i) {
+      if (i == 500) {
+        throw std::runtime_error("Index 500");
+      }
+    });
+  } catch (std::exception const &e) {
+    std::cout << "Caught: " << e.what() << std::endl;
+  }
+}
+
+void ExecutorResultTest() {
+  Utils::Executor executor(2);
+
+  std::cout << "Executor Result Test" << std::endl;
+  std::cout << "--------------------" << std::endl;
+
+  Utils::TaskHandle<int> answer = executor.Schedule([]() { return 42; });
+  Utils::TaskHandle<Defines::Str> text =
+      executor.Schedule([]() { return Defines::Str(100, 'x'); });
+  Utils::TaskHandle<Defines::Vec<int>> large = executor.Schedule(
+      []() { return Defines::Vec<int>(1000, 7); }, {answer, text});
+
+  std::cout << "Answer: " << answer.Get() << std::endl;
+  std::cout << "Text length: " << text.Get().size() << std::endl;
+  std::cout << "Vector sum: "
+            << std::accumulate(large.Get().begin(), large.Get().end(), 0)
+            << std::endl;
+
+  Utils::TaskHandle<int> failed = executor.Schedule([]() -> int {
+    throw std::runtime_error("No result");
+  });
+  try {
+    failed.Get();
+  } catch (std::exception const &e) {
+    std::cout << "Caught: " << e.what() << std::endl;
+  }
+}
+
+void ExecutorPriorityTest() {
+  Utils::Executor executor(1);
+  executor.SetMetricsEnabled(true);
+
+  std::cout << "Executor Priority Test" << std::endl;
+  std::cout << "----------------------" << std::endl;
+
+  // Hold the only worker until everything is queued.
+  Defines::Atomic<Defines::Bool> open = false;
+  Defines::Vec<Utils::Handle> handles;
+  handles.push_back(executor.Schedule([&open]() { open.wait(false); }));
+
+  Defines::Mutex mutex;
+  Defines::Str order;
+  auto record = [&](char tag) {
+    return [&, tag]() {
+      Defines::LockGuard<Defines::Mutex> lock(mutex);
+      order.push_back(tag);
+    };
+  };
+  auto now = Defines::Now();
+  for (int i = 0; i < 4; ++i) {
+    handles.push_back(executor.Schedule(
+        record('b'), {Utils::TaskPriority::Background}));
+    handles.push_back(executor.Schedule(record('n')));
+  }
+  handles.push_back(
+      executor.Schedule(record('c'), {Utils::TaskPriority::Critical}));
+  handles.push_back(executor.Schedule(
+      record('2'),
+      {Utils::TaskPriority::Normal, now + std::chrono::seconds(20)}));
+  handles.push_back(executor.Schedule(
+      record('1'),
+      {Utils::TaskPriority::Normal, now + std::chrono::seconds(10)}));
+  // Deadlines order tasks within their lane only: this one leads the
+  // background lane but still runs after the critical task.
+  handles.push_back(executor.Schedule(
+      record('d'),
+      {Utils::TaskPriority::Background, now + std::chrono::seconds(5)}));
+
+  open.store(true);
+  open.notify_all();
+  // Wait without helping so the worker alone decides the order.
+  for (auto const &handle : handles) {
+    handle.Wait();
+  }
+
+  std::cout << "Order: " << order << std::endl;
+  for (auto priority :
+       {Utils::TaskPriority::Critical, Utils::TaskPriority::Normal,
+        Utils::TaskPriority::Background}) {
+    Utils::LaneMetrics metrics = executor.GetLaneMetrics(priority);
+    std::cout << "Lane " << static_cast<int>(priority) << ": "
+              << metrics.numTasks << " tasks, "
+              << metrics.numMissedDeadlines << " missed deadlines"
+              << std::endl;
+  }
+}
+
+void ExecutorAffinityTest() {
+  std::cout << "Executor Affinity Test" << std::endl;
+  std::cout << "----------------------" << std::endl;
+
+  Defines::Vec<Defines::Vec<Defines::Uint>> nodes = Utils::GetNumaNodes();
+  std::cout << "NUMA nodes: " << nodes.size() << std::endl;
+
+  Utils::ExecutorOptions options;
+  options.numWorkers = 2;
+  options.mode = Utils::SchedulingMode::WorkStealing;
+  options.workerName = "TCWorker";
+  options.pinWorkers = true;
+  options.groupByNumaNode = true;
+  Utils::Executor executor(options);
+  std::cout << "Worker 1 pinned to " << executor.GetWorkerCpus(1).size()
+            << " CPU" << std::endl;
+
+  Defines::Atomic<int> counter = 0;
+  for (int i = 0; i < 1000; ++i) {
+    executor.Schedule([&counter]() { counter.fetch_add(1); });
+  }
+  executor.WaitForAll();
+  std::cout << "Tasks run: " << counter.load() << std::endl;
+}
+
+void ExecutorIdleTest() {
+  std::cout << "Executor Idle Test" << std::endl;
+  std::cout << "------------------" << std::endl;
+
+  for (Defines::Uint spins : {0u, 256u}) {
+    Utils::ExecutorOptions options;
+    options.numWorkers = 2;
+    options.idleSpins = spins;
+    options.idleYields = spins == 0 ? 0u : 8u;
+    Utils::Executor executor(options);
+
+    Defines::Atomic<int> counter = 0;
+    for (int burst = 0; burst < 20; ++burst) {
+      for (int i = 0; i < 50; ++i) {
+        executor.Schedule([&counter]() { counter.fetch_add(1); });
+      }
+      executor.WaitForAll();
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    Utils::IdleMetrics metrics = executor.GetIdleMetrics();
+    std::cout << "Spins " << spins << ": " << counter.load()
+              << " tasks run, spun " << (metrics.numSpins > 0 ? "yes" : "no")
+              << ", hits within spins "
+              << (metrics.numSpinHits <= metrics.numSpins ? "yes" : "no")
+              << std::endl;
+  }
+}
+
+void CancellationTest() {
+  Utils::Executor executor(1);
+
+  std::cout << "Cancellation Test" << std::endl;
+  std::cout << "-----------------" << std::endl;
+
+  Utils::CancellationSource source;
+  Utils::TaskOptions options;
+  options.token = source.GetToken();
+
+  // A running task polls its token.
+  Defines::Atomic<Defines::Bool> started = false;
+  Utils::Handle running = executor.Schedule(
+      [&started, token = options.token]() {
+        started.store(true);
+        started.notify_all();
+        while (!token.IsCancelled()) {
+          std::this_thread::yield();
+        }
+      },
+      options);
+  started.wait(false);
+
+  // These stay queued behind it on the only worker.
+  Defines::SharedPtr<int> payload = std::make_shared<int>(0);
+  Defines::Atomic<int> invoked = 0;
+  Defines::Vec<Utils::TaskHandle<int>> queued;
+  for (int i = 0; i < 1000; ++i) {
+    queued.push_back(executor.Schedule(
+        [payload, &invoked]() {
+          invoked.fetch_add(1);
+          return *payload;
+        },
+        options));
+  }
+  Utils::Handle dependent = executor.Schedule(
+      [&invoked]() { invoked.fetch_add(1); }, {queued.back()});
+
+  source.Cancel();
+  std::cout << "Payload references: " << payload.use_count() << std::endl;
+  executor.Schedule([&invoked]() { invoked.fetch_add(1); }, options);
+  executor.WaitForAll();
+
+  int numCancelled = 0;
+  for (auto const &handle : queued) {
+    numCancelled += handle.Cancelled() ? 1 : 0;
+  }
+  std::cout << "Cancelled: " << numCancelled << std::endl;
+  // Only the dependent task, which has no token, is invoked.
+  std::cout << "Invoked: " << invoked.load() << std::endl;
+  std::cout << "Running task cancelled: " << running.Cancelled() << std::endl;
+  try {
+    queued.front().Get();
+  } catch (Exceptions::TaskCancelled const &e) {
+    std::cout << "Caught: " << e.what() << std::endl;
+  }
+}
+
+void TimerTest() {
+  std::cout << "Timer Test" << std::endl;
+  std::cout << "----------" << std::endl;
+
+  {
+    Utils::Executor executor(2);
+    Defines::Mutex mutex;
+    Defines::Str order;
+    auto record = [&](char tag) {
+      return [&, tag]() {
+        Defines::LockGuard<Defines::Mutex> lock(mutex);
+        order.push_back(tag);
+      };
+    };
+    executor.ScheduleAfter(std::chrono::milliseconds(30), record('c'));
+    executor.ScheduleAfter(std::chrono::milliseconds(10), record('a'));
+    executor.ScheduleAfter(std::chrono::milliseconds(20), record('b'));
+    executor.ScheduleAt(Defines::Now() - std::chrono::seconds(1),
+                        record('0'));
+    executor.WaitForAll();
+    std::cout << "Order: " << order << std::endl;
+
+    // Many timers at once, half of them cancelled before they fire.
+    Defines::Atomic<int> fired = 0;
+    Defines::Atomic<int> early = 0;
+    Defines::Vec<Utils::Handle> handles;
+    for (int i = 0; i < 100000; ++i) {
+      auto due = Defines::Now() + std::chrono::milliseconds(50 + i % 150);
+      handles.push_back(executor.ScheduleAt(due, [&fired, &early, due]() {
+        early.fetch_add(Defines::Now() < due ? 1 : 0);
+        fired.fetch_add(1);
+      }));
+    }
+    int numCancelled = 0;
+    for (int i = 0; i < 100000; i += 2) {
+      numCancelled += executor.CancelTimer(handles[i]) ? 1 : 0;
+    }
+    executor.WaitForAll();
+    std::cout << "Fired or cancelled: " << fired.load() + numCancelled
+              << ", early: " << early.load() << std::endl;
+  }
+
+  // Timers still waiting when the executor goes away are dropped.
+  Utils::Handle pending;
+  {
+    Utils::Executor executor(1);
+    pending = executor.ScheduleAfter(std::chrono::hours(1), []() {});
+  }
+  std::cout << "Pending timer cancelled: " << pending.Cancelled() << std::endl;
+
+  // Tasks still draining during destruction may schedule timers; those are
+  // cancelled instead of starting a timer thread nobody joins.
+  Utils::Handle late;
+  Defines::Mutex lateMutex;
+  {
+    Utils::Executor executor(1);
+    executor.Schedule([&executor, &late, &lateMutex]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      Utils::Handle handle =
+          executor.ScheduleAfter(std::chrono::milliseconds(1), []() {});
+      Defines::LockGuard<Defines::Mutex> lock(lateMutex);
+      late = handle;
+    });
+  }
+  std::cout << "Late timer cancelled: " << late.Cancelled() << std::endl;
+}
+
+Utils::Task<int> LoadStage(Utils::Executor &executor, int value) {
+  co_await executor.Schedule();
+  co_return value;
+}
+
+Utils::Task<int> ProcessStage(Utils::Executor &executor) {
+  int first = co_await LoadStage(executor, 20);
+  int second = co_await LoadStage(executor, 22);
+  co_await executor.Schedule();
+  co_return first + second;
+}
+
+Utils::Task<> FailingStage(Utils::Executor &executor) {
+  co_await executor.Schedule();
+  throw std::runtime_error("Stage failed");
+}
+
+void PinnedTest() {
+  std::cout << "Pinned Test" << std::endl;
+  std::cout << "-----------" << std::endl;
+
+  Utils::ExecutorOptions options;
+  options.numWorkers = 4;
+  options.pinnedQueues = {"main"};
+  Utils::Executor executor(options);
+  Defines::ID main = executor.GetPinnedQueue("main");
+  std::thread::id self = std::this_thread::get_id();
+
+  // Every producer posts in order; the main thread must see each producer's
+  // tasks in that order and run all of them itself.
+  Defines::Vec<Defines::Vec<int>> seen(4);
+  Defines::Atomic<int> offThread = 0;
+  for (int producer = 0; producer < 4; ++producer) {
+    executor.Schedule([&, producer]() {
+      for (int i = 0; i < 1000; ++i) {
+        executor.SchedulePinned(main, [&, producer, i]() {
+          offThread.fetch_add(std::this_thread::get_id() != self ? 1 : 0);
+          seen[producer].push_back(i);
+        });
+      }
+    });
+  }
+  executor.WaitForAll();
+  Defines::Size numRun = executor.PumpPinned(main);
+
+  Defines::Bool ordered = true;
+  for (auto const &values : seen) {
+    for (Defines::Size i = 0; i < values.size(); ++i) {
+      ordered = ordered && values[i] == static_cast<int>(i);
+    }
+  }
+  std::cout << "Run: " << numRun << ", ordered: " << ordered
+            << ", off thread: " << offThread.load() << std::endl;
+
+  // A budget stops the pump after the task that overran it.
+  for (int i = 0; i < 10; ++i) {
+    executor.SchedulePinned(main, []() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    });
+  }
+  Defines::Size none = executor.PumpPinned(main, Defines::NanoSec(0));
+  Defines::Size first = executor.PumpPinned(main, std::chrono::milliseconds(12));
+  Defines::Size rest = executor.PumpPinned(main);
+  std::cout << "Zero budget: " << none << ", budgeted: " << (first < 10)
+            << ", total: " << first + rest << std::endl;
+
+  try {
+    executor.GetPinnedQueue("render");
+  } catch (Exceptions::ExecutorError const &) {
+    std::cout << "Caught unknown queue" << std::endl;
+  }
+
+  // A worker blocks on a pinned task posted after the owner parked in a
+  // wait; the owner has to wake up and run it.
+  for (int round = 0; round < 2; ++round) {
+    Defines::Atomic<Defines::Bool> started = false;
+    Utils::TaskHandle<int> blocked =
+        executor.Schedule([&executor, &started, main]() {
+          started.store(true);
+          std::this_thread::sleep_for(std::chrono::milliseconds(20));
+          return executor.SchedulePinned(main, []() { return 7; }).Get();
+        });
+    // The owner must not pick the task up itself, or it would block in Get().
+    while (!started.load()) {
+      std::this_thread::yield();
+    }
+    if (round == 0) {
+      executor.Wait(blocked);
+    } else {
+      executor.WaitForAll();
+    }
+    std::cout << (round == 0 ? "Wait" : "WaitForAll")
+              << " ran pinned task: " << blocked.Get() << std::endl;
+  }
+
+  // Pinned tasks posted while the executor is being destroyed are dropped
+  // with their payload rather than left in the queue.
+  auto payload = std::make_shared<int>(0);
+  Utils::Handle late;
+  Defines::Mutex lateMutex;
+  {
+    Utils::Executor draining(options);
+    Defines::ID queue = draining.GetPinnedQueue("main");
+    draining.Schedule([&draining, &late, &lateMutex, queue, payload]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      Utils::Handle handle =
+          draining.SchedulePinned(queue, [payload]() { ++*payload; });
+      Defines::LockGuard<Defines::Mutex> lock(lateMutex);
+      late = handle;
+    });
+  }
+  std::cout << "Late pinned task cancelled: " << late.Cancelled()
+            << ", payload references: " << payload.use_count() << std::endl;
+}
+
+void TraceTest() {
+  std::cout << "Trace Test" << std::endl;
+  std::cout << "----------" << std::endl;
+
+  if (!Utils::TaskTracer::IsCompiled()) {
+    std::cout << "Built without TERREATECORE_EXECUTOR_TRACE" << std::endl;
+    return;
+  }
+
+  Utils::TaskTracer &tracer = Utils::TaskTracer::Instance();
+  tracer.Clear();
+  {
+    Utils::Executor executor(4);
+    Utils::TaskOptions options;
+    options.label = "traced";
+    for (int i = 0; i < 1000; ++i) {
+      executor.Schedule([]() {}, options);
+    }
+    executor.Schedule([]() {});
+    executor.WaitForAll();
+  }
+
+  int numLabelled = 0;
+  int numOrdered = 0;
+  int numKnownThreads = 0;
+  for (auto const &event : tracer.Collect()) {
+    Defines::Str label = event.label ? event.label : "";
+    numLabelled += label == "traced" ? 1 : 0;
+    numOrdered += event.enqueued <= event.started &&
+                          event.started <= event.finished
+                      ? 1
+                      : 0;
+    // Waiting threads run tasks too, so not every event has a worker.
+    numKnownThreads += event.worker < 4 ||
+                               event.worker == Utils::TraceEvent::sNoWorker
+                           ? 1
+                           : 0;
+  }
+  Defines::Str json = tracer.ToChromeTrace();
+  std::cout << "Labelled: " << numLabelled << ", ordered: " << numOrdered
+            << ", known threads: " << numKnownThreads << std::endl;
+  std::cout << "Chrome trace: "
+            << (json.find("\"traceEvents\"") != Defines::Str::npos)
+            << std::endl;
+
+  // Threads that come and go share buffers instead of leaking one each.
+  Defines::Size numBuffers = tracer.GetNumBuffers();
+  for (int i = 0; i < 50; ++i) {
+    Defines::Thread([&tracer]() {
+      Utils::TraceEvent event;
+      event.label = "short-lived";
+      tracer.Record(event);
+    }).join();
+  }
+  std::cout << "Buffers recycled: "
+            << (tracer.GetNumBuffers() <= numBuffers + 1) << std::endl;
+  tracer.Clear();
+}
+
+void TaskGroupTest() {
+  std::cout << "Task Group Test" << std::endl;
+  std::cout << "---------------" << std::endl;
+
+  Utils::Executor executor(4);
+  {
+    Defines::Atomic<int> counter = 0;
+    Utils::TaskGroup group(executor);
+    for (int i = 0; i < 100; ++i) {
+      group.Spawn([&group, &counter]() {
+        for (int j = 0; j < 10; ++j) {
+          group.Spawn([&counter]() { counter.fetch_add(1); });
+        }
+        counter.fetch_add(1);
+      });
+    }
+    group.Wait();
+    std::cout << "Ran: " << counter.load()
+              << ", pending: " << group.GetNumPending() << std::endl;
+  }
+
+  // The first failure cancels what has not started and is rethrown.
+  {
+    Defines::Atomic<int> counter = 0;
+    Utils::TaskGroup group(executor);
+    group.Spawn([]() { throw std::runtime_error("first"); });
+    for (int i = 0; i < 10000; ++i) {
+      group.Spawn([&counter]() {
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+        counter.fetch_add(1);
+      });
+    }
+    try {
+      group.Wait();
+    } catch (std::runtime_error const &error) {
+      std::cout << "Caught: " << error.what()
+                << ", cancelled: " << group.IsCancelled()
+                << ", skipped some: " << (counter.load() < 10000)
+                << std::endl;
+    }
+  }
+
+  // Leaving the scope without Wait() drops what is left and joins the rest.
+  Defines::Atomic<int> started = 0;
+  {
+    Utils::TaskGroup group(executor);
+    for (int i = 0; i < 10000; ++i) {
+      group.Spawn([&started]() {
+        started.fetch_add(1);
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+      });
+    }
+  }
+  executor.WaitForAll();
+  std::cout << "Dropped on scope exit: " << (started.load() < 10000)
+            << std::endl;
+
+  // A task spawned after Wait() may still be finishing when the group goes
+  // away; the destructor has to wait for it either way.
+  Defines::Atomic<int> late = 0;
+  for (int i = 0; i < 1000; ++i) {
+    Utils::TaskGroup group(executor);
+    group.Spawn([&late]() { late.fetch_add(1); });
+    group.Wait();
+    group.Spawn([&late]() { late.fetch_add(1); });
+    while (group.GetNumPending() != 0) {
+      std::this_thread::yield();
+    }
+  }
+  std::cout << "Spawned after wait: " << late.load() << std::endl;
+}
+
+void ScheduleBatchTest() {
+  std::cout << "Schedule Batch Test" << std::endl;
+  std::cout << "-------------------" << std::endl;
+
+  for (auto mode : {Utils::SchedulingMode::SingleQueue,
+                    Utils::SchedulingMode::WorkStealing}) {
+    Utils::Executor executor(4, mode);
+    Defines::Atomic<int> counter = 0;
+
+    // Larger than the injection queue, so the batch goes in several parts.
+    Defines::Vec<Utils::Runnable> targets(100000, [&counter]() {
+      counter.fetch_add(1);
+    });
+    Defines::Size numScheduled = executor.ScheduleBatch(targets);
+
+    // Move-only callables are moved out of an rvalue range.
+    auto makeTask = [&counter](int value) {
+      return [&counter, owned = std::make_unique<int>(value)]() {
+        counter.fetch_add(*owned);
+      };
+    };
+    Defines::Vec<decltype(makeTask(0))> moveOnly;
+    for (int i = 0; i < 100; ++i) {
+      moveOnly.push_back(makeTask(1));
+    }
+    numScheduled += executor.ScheduleBatch(std::move(moveOnly));
+
+    // A batch from a worker lands in its own deque.
+    executor.Schedule([&]() {
+      Defines::Vec<Utils::Runnable> nested(1000, [&counter]() {
+        counter.fetch_add(1);
+      });
+      executor.ScheduleBatch(nested);
+    });
+
+    Utils::TaskOptions options;
+    options.deadline = Defines::Now() + std::chrono::seconds(1);
+    numScheduled += executor.ScheduleBatch(
+        Defines::Vec<Utils::Runnable>(10, [&counter]() {
+          counter.fetch_add(1);
+        }),
+        options);
+
+    // A temporary span borrows the jobs, so they survive for the next frame.
+    Defines::Vec<Utils::Runnable> frameJobs(8, [&counter]() {
+      counter.fetch_add(1);
+    });
+    for (int frame = 0; frame < 2; ++frame) {
+      numScheduled += executor.ScheduleBatch(std::span(frameJobs));
+      executor.WaitForAll();
+    }
+
+    executor.WaitForAll();
+    std::cout << "[" << (mode == Utils::SchedulingMode::WorkStealing
+                             ? "work-stealing"
+                             : "single-queue")
+              << "] scheduled: " << numScheduled
+              << ", ran: " << counter.load() << std::endl;
+  }
+}
+
+void ReplayTest() {
+  std::cout << "Replay Test" << std::endl;
+  std::cout << "-----------" << std::endl;
+
+  struct Step {
+    char label;
+    int index;
+    std::thread::id thread;
+  };
+  // Two labels, queued from this thread, plus unlabelled noise.
+  auto run = [](Utils::Executor &executor, Defines::Vec<Step> &steps) {
+    Defines::Mutex mutex;
+    Utils::TaskOptions a;
+    a.label = "a";
+    Utils::TaskOptions b;
+    b.label = "b";
+    for (int i = 0; i < 200; ++i) {
+      Utils::TaskOptions const &options = i % 3 == 0 ? b : a;
+      char label = options.label[0];
+      executor.Schedule(
+          [&, label, i]() {
+            std::this_thread::sleep_for(std::chrono::microseconds(i % 7 * 10));
+            Defines::LockGuard<Defines::Mutex> lock(mutex);
+            steps.push_back({label, i, std::this_thread::get_id()});
+          },
+          options);
+      executor.Schedule([]() {});
+    }
+    executor.WaitForAll();
+  };
+
+  Defines::Vec<Step> recorded;
+  Utils::ReplayLog log;
+  {
+    Utils::Executor executor(4);
+    executor.StartRecording();
+    run(executor, recorded);
+    log = executor.StopRecording();
+  }
+  Defines::Vec<Defines::Ubyte> data = log.Encode();
+  Utils::ReplayLog decoded = Utils::ReplayLog::Decode(data);
+  Utils::ReplayLog header;
+  header.labels = log.labels;
+  Defines::Size entryBytes = data.size() - header.Encode().size();
+  std::cout << "Entries: " << decoded.entries.size()
+            << ", labels: " << decoded.labels.size() << ", bytes per entry: "
+            << (entryBytes + decoded.entries.size() / 2) /
+                   decoded.entries.size()
+            << std::endl;
+
+  // The log holds start order; map it back to task indices.
+  Defines::Vec<int> expected;
+  Defines::Map<char, Defines::Vec<int>> indices;
+  for (int i = 0; i < 200; ++i) {
+    indices[i % 3 == 0 ? 'b' : 'a'].push_back(i);
+  }
+  for (auto const &entry : decoded.entries) {
+    expected.push_back(
+        indices[decoded.labels[entry.label][0]][entry.occurrence]);
+  }
+  for (int attempt = 0; attempt < 3; ++attempt) {
+    Defines::Vec<Step> replayed;
+    Utils::Executor executor(4);
+    executor.StartReplay(decoded);
+    run(executor, replayed);
+
+    Defines::Bool sameOrder = replayed.size() == expected.size();
+    // Tasks logged on the same worker run on one thread again. Tasks a
+    // waiting thread ran may run anywhere.
+    Defines::Map<Defines::Uint, std::thread::id> threads;
+    Defines::Bool sameWorkers = true;
+    for (Defines::Size i = 0; sameOrder && i < expected.size(); ++i) {
+      sameOrder = replayed[i].index == expected[i];
+      Defines::Uint worker = decoded.entries[i].worker;
+      if (worker != Utils::ReplayEntry::sNoWorker) {
+        auto mapped = threads.emplace(worker, replayed[i].thread);
+        sameWorkers =
+            sameWorkers && mapped.first->second == replayed[i].thread;
+      }
+    }
+    std::cout << "Replay " << attempt << ": order " << sameOrder
+              << ", workers " << sameWorkers << ", position "
+              << executor.GetReplayPosition() << ", mode "
+              << static_cast<int>(executor.GetReplayMode()) << std::endl;
+  }
+
+  // Threads record into their own buffers; the merged log still has every
+  // task of every label exactly once.
+  {
+    Utils::Executor executor(4);
+    executor.StartRecording();
+    Defines::Vec<std::thread> producers;
+    for (int t = 0; t < 4; ++t) {
+      producers.emplace_back([&executor, t]() {
+        static char const *const labels[] = {"t0", "t1", "t2", "t3"};
+        Utils::TaskOptions options;
+        options.label = labels[t];
+        for (int i = 0; i < 100; ++i) {
+          executor.Schedule([]() {}, options);
+        }
+      });
+    }
+    for (auto &producer : producers) {
+      producer.join();
+    }
+    executor.WaitForAll();
+    Utils::ReplayLog merged = executor.StopRecording();
+    Defines::Set<Defines::Ulong> keys;
+    for (auto const &entry : merged.entries) {
+      keys.insert(static_cast<Defines::Ulong>(entry.label) << 32 |
+                  entry.occurrence);
+    }
+    std::cout << "Merged: " << merged.entries.size() << ", unique "
+              << keys.size() << ", labels " << merged.labels.size()
+              << std::endl;
+  }
+
+  // The log expects "b" first, but this run never schedules it. The held
+  // task fails instead of hanging WaitForAll().
+  {
+    Utils::ReplayLog diverging;
+    diverging.labels = {"a", "b"};
+    diverging.entries = {{1u, 0u, 0u}, {0u, 0u, 0u}};
+    Utils::Executor executor(2);
+    executor.StartReplay(diverging);
+    Utils::TaskOptions a;
+    a.label = "a";
+    Defines::Bool ran = false;
+    auto handle = executor.Schedule([&ran]() { ran = true; }, a);
+    executor.WaitForAll();
+    Defines::Bool diverged = false;
+    try {
+      handle.Get();
+    } catch (Exceptions::ExecutorError const &) {
+      diverged = true;
+    }
+    std::cout << "Diverged: " << diverged << ", ran " << ran << ", mode "
+              << static_cast<int>(executor.GetReplayMode()) << std::endl;
+  }
+
+  try {
+    Utils::ReplayLog::Decode({'x', 'y'});
+  } catch (Exceptions::ExecutorError const &) {
+    std::cout << "Caught malformed log" << std::endl;
+  }
+}
+
+void ArenaTest() {
+  std::cout << "Arena Test" << std::endl;
+  std::cout << "----------" << std::endl;
+
+  Utils::ScratchArena arena(256);
+  Utils::ScratchArena::Marker start = arena.GetMarker();
+  Defines::Bool aligned = true;
+  for (int i = 0; i < 100; ++i) {
+    void *ptr = arena.Allocate(24, 16);
+    aligned = aligned && reinterpret_cast<std::uintptr_t>(ptr) % 16 == 0;
+  }
+  Defines::Size capacity = arena.GetCapacity();
+  arena.Rewind(start);
+  for (int i = 0; i < 100; ++i) {
+    arena.Allocate(24, 16);
+  }
+  std::cout << "Aligned: " << aligned
+            << ", reused after rewind: " << (arena.GetCapacity() == capacity)
+            << std::endl;
+
+  {
+    Utils::ArenaVec<int> values{Utils::ArenaAllocator<int>(arena)};
+    Utils::ArenaMap<int, int> squares{Utils::ArenaAllocator<int>(arena)};
+    for (int i = 0; i < 100; ++i) {
+      values.push_back(i);
+      squares[i] = i * i;
+    }
+    std::cout << "Vec sum: " << std::accumulate(values.begin(), values.end(), 0)
+              << ", map[9]: " << squares[9] << std::endl;
+  }
+  arena.Reset();
+
+  // Tasks build temporaries in their worker's arena, which is rewound after
+  // each task, so it stops growing once warm.
+  Utils::Executor executor(4);
+  Defines::Atomic<long> total = 0;
+  Defines::Atomic<int> wrongArena = 0;
+  for (int i = 0; i < 2000; ++i) {
+    executor.Schedule([&total, &wrongArena]() {
+      Utils::ScratchArena &local = Utils::Executor::CurrentArena();
+      Utils::ArenaVec<long> scratch{Utils::ArenaAllocator<long>(local)};
+      for (long j = 0; j < 1000; ++j) {
+        scratch.push_back(j);
+      }
+      total.fetch_add(std::accumulate(scratch.begin(), scratch.end(), 0l));
+      wrongArena.fetch_add(&scratch.get_allocator().GetArena() != &local);
+    });
+  }
+  executor.WaitForAll();
+  Defines::Size numChunks = 0;
+  for (int i = 0; i < 100; ++i) {
+    executor.Schedule([&numChunks]() {
+      numChunks = std::max(numChunks,
+                           Utils::Executor::CurrentArena().GetNumChunks());
+    });
+    executor.WaitForAll();
+  }
+  std::cout << "Total: " << total.load() << ", wrong arena: "
+            << wrongArena.load() << ", chunks bounded: " << (numChunks <= 2)
+            << std::endl;
+}
+
+void CoroutineTest() {
+  Utils::Executor executor(2);
+
+  std::cout << "Coroutine Test" << std::endl;
+  std::cout << "--------------" << std::endl;
+
+  std::cout << "Result: " << Utils::SyncWait(executor, ProcessStage(executor))
+            << std::endl;
+
+  try {
+    Utils::SyncWait(executor, FailingStage(executor));
+  } catch (std::exception const &e) {
+    std::cout << "Caught: " << e.what() << std::endl;
+  }
+}
+
 void EventTest() {
   Utils::Event<int> event;
-  event.Subscribe([](int i) { std::cout << "Event 1: " << i << std::endl; });
-  event.Subscribe([](int i) { std::cout << "Event 2: " << i << std::endl; });
+  Utils::Subscription sub1 = event.Subscribe(
+      [](int i) { std::cout << "Event 1: " << i << std::endl; });
+  Utils::Subscription sub2 = event.Subscribe(
+      [](int i) { std::cout << "Event 2: " << i << std::endl; });
   event.Publish(5);
 
   Utils::Event<> event2;
-  event2.Subscribe([]() { std::cout << "Event 3" << std::endl; });
-  event2.Subscribe([]() { std::cout << "Event 4" << std::endl; });
+  event2 += []() { std::cout << "Event 3" << std::endl; };
+  event2 += []() { std::cout << "Event 4" << std::endl; };
   event2.Publish();
 
   Utils::Event<int *> event3;
-  event3.Subscribe([](int *i) { std::cout << "Event 5: " << *i << std::endl; });
-  event3.Subscribe([](int *i) { std::cout << "Event 6: " << *i << std::endl; });
+  Utils::Subscription sub5 = event3.Subscribe(
+      [](int *i) { std::cout << "Event 5: " << *i << std::endl; });
+  Utils::Subscription sub6 = event3.Subscribe(
+      [](int *i) { std::cout << "Event 6: " << *i << std::endl; });
 
   int i = 5;
   int *p = &i;
   event3.Publish(p);
+
+  // Tokens unsubscribe when destroyed, and a moved-from token is empty.
+  Utils::Event<int> scoped;
+  int numScoped = 0;
+  Utils::Subscription kept =
+      scoped.Subscribe([&numScoped](int) { ++numScoped; });
+  {
+    Utils::Subscription temporary =
+        scoped.Subscribe([&numScoped](int) { numScoped += 10; });
+    scoped.Publish(0);
+  }
+  scoped.Publish(0);
+  Utils::Subscription moved = std::move(kept);
+  scoped.Publish(0);
+  std::cout << "Scoped calls: " << numScoped << ", moved-from active: "
+            << kept.IsActive() << std::endl;
+  moved.Unsubscribe();
+  // The slot is reused; the stale token must not remove the new subscriber.
+  Utils::Subscription reused =
+      scoped.Subscribe([&numScoped](int) { numScoped += 100; });
+  moved.Unsubscribe();
+  scoped.Publish(0);
+  std::cout << "After reuse: " << numScoped << std::endl;
+
+  // A callback may drop its own subscription while being published.
+  Utils::Event<> once;
+  int numOnce = 0;
+  Utils::Subscription onceSub;
+  onceSub = once.Subscribe([&onceSub, &numOnce]() {
+    ++numOnce;
+    onceSub.Unsubscribe();
+  });
+  once.Publish();
+  once.Publish();
+  std::cout << "Once calls: " << numOnce << std::endl;
+
+  // Callbacks may subscribe and publish again without deadlocking.
+  Utils::Event<int> reentrant;
+  int numCalls = 0;
+  reentrant += [&reentrant, &numCalls](int depth) {
+    ++numCalls;
+    if (depth == 0) {
+      reentrant += [&numCalls](int) { ++numCalls; };
+      reentrant.Publish(depth + 1);
+    }
+  };
+  reentrant.Publish(0);
+  std::cout << "Reentrant calls: " << numCalls << std::endl;
+
+  // Publishers run concurrently while subscribers come and go.
+  Utils::Event<int> shared;
+  Defines::Atomic<long> total = 0;
+  Utils::Subscription counter =
+      shared.Subscribe([&total](int value) { total.fetch_add(value); });
+  Defines::Vec<Defines::Thread> publishers;
+  for (int t = 0; t < 4; ++t) {
+    publishers.emplace_back([&shared]() {
+      for (int j = 0; j < 10000; ++j) {
+        shared.Publish(1);
+      }
+    });
+  }
+  Defines::Vec<Utils::Subscription> churn;
+  for (int j = 0; j < 1000; ++j) {
+    churn.push_back(shared.Subscribe([](int) {}));
+    if (j % 3 == 0) {
+      churn[j / 2].Unsubscribe();
+    }
+  }
+  churn.clear();
+  for (auto &publisher : publishers) {
+    publisher.join();
+  }
+  std::cout << "Concurrent total: " << total.load() << std::endl;
+
+  // Publishers that never pause must not keep every replaced snapshot
+  // alive; each one goes once its own publishers have left.
+  Utils::Event<int> busy;
+  Defines::Vec<Utils::Subscription> listeners;
+  for (int j = 0; j < 1000; ++j) {
+    listeners.push_back(busy.Subscribe([](int) {}));
+  }
+  Defines::Atomic<Defines::Bool> publishing = true;
+  Defines::Vec<Defines::Thread> busyPublishers;
+  for (int t = 0; t < 4; ++t) {
+    busyPublishers.emplace_back([&busy, &publishing]() {
+      while (publishing.load()) {
+        busy.Publish(0);
+      }
+    });
+  }
+  Defines::Size maxRetired = 0u;
+  for (int j = 0; j < 20000; ++j) {
+    busy.Subscribe([](int) {}).Unsubscribe();
+    maxRetired = std::max(maxRetired, busy.GetNumRetired());
+  }
+  publishing.store(false);
+  for (auto &publisher : busyPublishers) {
+    publisher.join();
+  }
+  std::cout << "Retired snapshots bounded: " << (maxRetired < 100)
+            << std::endl;
+
+  // A publish that is still running pins only its own snapshot; the ones
+  // replaced after it are recycled meanwhile.
+  Utils::Event<> pinned;
+  Defines::Size pinnedRetired = 0u;
+  Utils::Subscription churner = pinned.Subscribe([&pinned, &pinnedRetired]() {
+    for (int j = 0; j < 1000; ++j) {
+      pinned.Subscribe([]() {}).Unsubscribe();
+    }
+    pinnedRetired = pinned.GetNumRetired();
+  });
+  pinned.Publish();
+  std::cout << "Retired while pinned: " << pinnedRetired
+            << ", after: " << pinned.GetNumRetired() << std::endl;
+}
+
+void QueuedEventTest() {
+  std::cout << "Queued Event Test" << std::endl;
+  std::cout << "-----------------" << std::endl;
+
+  Utils::QueuedEvent<int, Defines::Str const &> queued(256);
+  Defines::Vec<int> order;
+  Defines::Vec<int> received;
+  Utils::Subscription first =
+      queued.Subscribe([&order, &received](int value, Defines::Str const &) {
+        order.push_back(0);
+        received.push_back(value);
+      });
+  Utils::Subscription second =
+      queued.Subscribe([&order, &queued](int value, Defines::Str const &) {
+        order.push_back(1);
+        if (value == 0) {
+          queued.Publish(-1, "late");
+        }
+      });
+
+  Defines::Vec<Defines::Thread> publishers;
+  for (int t = 0; t < 4; ++t) {
+    publishers.emplace_back([&queued, t]() {
+      for (int j = 0; j < 50; ++j) {
+        queued.Publish(t * 50 + j, "event");
+      }
+    });
+  }
+  for (auto &publisher : publishers) {
+    publisher.join();
+  }
+  std::cout << "Delivered before flush: " << order.size() << std::endl;
+
+  Defines::Size numFlushed = queued.Flush();
+  std::sort(received.begin(), received.end());
+  Defines::Bool complete = received.size() == 200;
+  for (int j = 0; complete && j < 200; ++j) {
+    complete = received[j] == j;
+  }
+  std::cout << "Flushed: " << numFlushed << ", complete: " << complete
+            << ", grouped by subscriber: "
+            << std::is_sorted(order.begin(), order.end()) << std::endl;
+  std::cout << "Republished for next flush: " << queued.Flush() << std::endl;
+
+  Defines::Size numQueued = 0;
+  while (queued.Publish(0, "fill")) {
+    ++numQueued;
+  }
+  std::cout << "Queued until full: " << numQueued << " of "
+            << queued.GetCapacity() << std::endl;
+
+  // A throwing subscriber does not cut the batch short for the others.
+  Utils::QueuedEvent<int> throwing;
+  int numDelivered = 0;
+  Utils::Subscription thrower = throwing.Subscribe([](int value) {
+    if (value == 1) {
+      throw std::runtime_error("bad event");
+    }
+  });
+  Utils::Subscription counter =
+      throwing.Subscribe([&numDelivered](int) { ++numDelivered; });
+  for (int j = 0; j < 4; ++j) {
+    throwing.Publish(j);
+  }
+  try {
+    throwing.Flush();
+  } catch (std::runtime_error const &e) {
+    std::cout << "Caught: " << e.what();
+  }
+  std::cout << ", delivered to the other: " << numDelivered
+            << ", left queued: " << !throwing.IsEmpty() << std::endl;
+}
+
+void PublishAsyncTest() {
+  std::cout << "Publish Async Test" << std::endl;
+  std::cout << "------------------" << std::endl;
+
+  Utils::Executor executor(4);
+  Utils::Event<int, Defines::Str const &> event;
+  Defines::Vec<Defines::Atomic<int>> calls(300);
+  Defines::Vec<Utils::Subscription> subscriptions;
+  for (int i = 0; i < 300; ++i) {
+    subscriptions.push_back(event.Subscribe(
+        [&calls, i](int value, Defines::Str const &name) {
+          if (name == "world") {
+            calls[i].fetch_add(value);
+          }
+        }));
+  }
+
+  Utils::Handle handle = event.PublishAsync(executor, 2, "world");
+  // Changes after the call do not affect the publish in flight.
+  Defines::Str late = "late";
+  Utils::Subscription extra =
+      event.Subscribe([&late](int, Defines::Str const &) { late.clear(); });
+  handle.Get();
+  Defines::Bool all = std::all_of(calls.begin(), calls.end(),
+                                  [](auto const &count) { return count == 2; });
+  std::cout << "Every subscriber called once: " << all
+            << ", later subscriber skipped: " << (late == "late") << std::endl;
+
+  Utils::Subscription failing = event.Subscribe(
+      [](int, Defines::Str const &) { throw std::runtime_error("boom"); });
+  Utils::Handle failed = event.PublishAsync(executor, 1, "world");
+  try {
+    failed.Get();
+    std::cout << "Missing exception" << std::endl;
+  } catch (std::exception const &error) {
+    std::cout << "Caught: " << error.what() << ", others still ran: "
+              << (calls[299].load() == 3) << std::endl;
+  }
+
+  Utils::Event<> empty;
+  empty.PublishAsync(executor).Get();
+  std::cout << "Empty event completed" << std::endl;
 }
 
 int main() {